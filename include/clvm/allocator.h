@@ -0,0 +1,175 @@
+#ifndef CHIA_ALLOCATOR_H
+#define CHIA_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace chia
+{
+
+class Allocator;
+
+/// Give up the ownership of an arena, it is freed once the nodes allocated from it have gone
+struct AllocatorReleaser {
+    void operator()(Allocator* allocator) const;
+};
+
+using AllocatorPtr = std::unique_ptr<Allocator, AllocatorReleaser>;
+
+/**
+ * An arena owns the memory of the nodes created while it is installed on the
+ * current thread. Memory is carved from contiguous blocks, a node released by
+ * its owner goes back to the free list of its size and is reused by the next
+ * node of the same size, so the arena only grows to the peak number of live
+ * nodes. Nodes larger than `MAX_NODE_SIZE` are allocated from the heap.
+ *
+ * Nodes may only be released on the owner thread until the arena is released,
+ * after that the remaining nodes may be released on any thread and the last
+ * one frees the arena.
+ *
+ * The arena is not passed to the code creating the nodes, every `MakeShared`
+ * on the thread takes it while it is installed, including the ones of the
+ * operators and of any code they call. An object which is kept beyond the run
+ * must be built in an `AllocatorScope` of nullptr, otherwise its nodes keep
+ * the blocks of the arena alive and may only be released on the owner thread
+ * until the run ends. The nodes are still `std::shared_ptr`, the arena saves
+ * the heap allocations but not the atomic reference counting.
+ */
+class Allocator
+{
+public:
+    static constexpr std::size_t MIN_BLOCK_SIZE = 4 * 1024;
+
+    static constexpr std::size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+    static constexpr std::size_t GRANULE_SIZE = 16;
+
+    static constexpr std::size_t MAX_NODE_SIZE = 256;
+
+    /// Get the arena installed on current thread, nullptr means nodes are allocated from the heap
+    static Allocator* GetCurrent();
+
+    /// Create an arena, the memory is allocated on demand
+    static AllocatorPtr Create();
+
+    Allocator(Allocator const&) = delete;
+
+    Allocator& operator=(Allocator const&) = delete;
+
+    /**
+     * Allocate a piece of memory from the arena
+     *
+     * @param size The number of bytes
+     * @param align The alignment of the memory, must be a power of 2
+     *
+     * @return The pointer to the memory, it is valid until it is deallocated
+     */
+    void* Allocate(std::size_t size, std::size_t align);
+
+    /// Return a piece of memory to the arena, `size` and `align` must be the ones it was allocated with
+    void Deallocate(void* p, std::size_t size, std::size_t align);
+
+    /// Number of blocks the arena holds
+    std::size_t GetNumBlocks() const { return blocks_.size(); }
+
+    /// Number of bytes handed out by the arena, including the reused ones
+    std::size_t GetUsedBytes() const { return used_; }
+
+    /// Number of bytes held in blocks
+    std::size_t GetReservedBytes() const { return reserved_; }
+
+private:
+    friend struct AllocatorReleaser;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    static constexpr std::size_t NUM_SIZE_CLASSES = MAX_NODE_SIZE / GRANULE_SIZE;
+
+    Allocator() = default;
+
+    static bool IsPooled(std::size_t size, std::size_t align)
+    {
+        return size <= MAX_NODE_SIZE && align <= alignof(std::max_align_t);
+    }
+
+    void* AllocateFromBlock(std::size_t size);
+
+    void Release();
+
+    std::vector<std::unique_ptr<uint8_t[]>> blocks_;
+    FreeNode* free_lists_[NUM_SIZE_CLASSES] {};
+    uint8_t* cursor_ { nullptr };
+    std::size_t left_ { 0 };
+    std::size_t used_ { 0 };
+    std::size_t reserved_ { 0 };
+    std::size_t num_live_ { 0 };
+    bool released_ { false };
+    std::atomic<std::size_t> num_remaining_ { 0 };
+};
+
+/// Install an arena on current thread, nullptr takes the heap, the previous one is restored when the scope ends
+class AllocatorScope
+{
+public:
+    explicit AllocatorScope(Allocator* allocator);
+
+    ~AllocatorScope();
+
+    AllocatorScope(AllocatorScope const&) = delete;
+
+    AllocatorScope& operator=(AllocatorScope const&) = delete;
+
+private:
+    Allocator* prev_;
+};
+
+/// STL allocator on top of the arena, it only holds a pointer so copying it is free
+template <typename T> class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Allocator* arena)
+        : arena_(arena)
+    {
+    }
+
+    template <typename U>
+    ArenaAllocator(ArenaAllocator<U> const& rhs)
+        : arena_(rhs.GetArena())
+    {
+    }
+
+    T* allocate(std::size_t n) { return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T))); }
+
+    void deallocate(T* p, std::size_t n) { arena_->Deallocate(p, n * sizeof(T), alignof(T)); }
+
+    Allocator* GetArena() const { return arena_; }
+
+    template <typename U> bool operator==(ArenaAllocator<U> const& rhs) const { return arena_ == rhs.GetArena(); }
+
+    template <typename U> bool operator!=(ArenaAllocator<U> const& rhs) const { return arena_ != rhs.GetArena(); }
+
+private:
+    Allocator* arena_;
+};
+
+/// Create an object from the arena installed on current thread, or from the heap when there is no arena
+template <typename T, typename... Args> std::shared_ptr<T> MakeShared(Args&&... args)
+{
+    Allocator* arena = Allocator::GetCurrent();
+    if (arena) {
+        return std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+    }
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+} // namespace chia
+
+#endif
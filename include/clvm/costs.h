@@ -8,6 +8,9 @@ namespace chia
 
 uint64_t const INFINITE_COST = 0x7FFFFFFFFFFFFFFF;
 
+/// The most a whole block is allowed to cost, a single spend can never go beyond it
+uint64_t const MAX_BLOCK_COST_CLVM = 11000000000;
+
 int const IF_COST = 33;
 int const CONS_COST = 50;
 int const FIRST_COST = 30;
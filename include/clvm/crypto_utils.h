@@ -21,6 +21,8 @@ public:
 
     void Add(Bytes const& bytes);
 
+    void Add(BytesView bytes);
+
     Bytes32 Finish();
 
 private:
@@ -1,6 +1,10 @@
 #ifndef CHIA_INT_H
 #define CHIA_INT_H
 
+#include <cstddef>
+#include <cstdint>
+
+#include <limits>
 #include <memory>
 #include <string>
 
@@ -11,23 +15,46 @@ namespace chia
 
 struct Impl;
 
+/// Deletes `Impl` out of line, so the inline constructors of `Int` don't require the definition of it
+struct ImplDeleter {
+    void operator()(Impl* impl) const;
+};
+
+/**
+ * Arbitrary precision integer, a value that fits in 64 bits is stored inline and
+ * the arithmetic on it doesn't touch GMP, it is only promoted to a GMP integer
+ * when the result overflows
+ */
 class Int
 {
 public:
     static bool IsValidNumberStr(std::string s);
 
-    Int();
+    Int() = default;
 
     ~Int();
 
     Int(Int const& rhs);
 
+    Int(Int&& rhs) noexcept;
+
     /// Parse an integer from a string
     Int(std::string s, int base);
 
     explicit Int(Bytes const& s, bool neg = false);
 
-    explicit Int(long val);
+    explicit Int(long val)
+        : small_(val)
+    {
+    }
+
+    /// Decode an integer from big-endian two's complement bytes, the form integers take in CLVM atoms
+    static Int FromSignedBytes(uint8_t const* data, std::size_t size);
+
+    static Int FromSignedBytes(Bytes const& bytes) { return FromSignedBytes(bytes.data(), bytes.size()); }
+
+    /// Encode the integer to the shortest big-endian two's complement bytes, zero is encoded to empty bytes
+    Bytes ToSignedBytes() const;
 
     Bytes ToBytes(bool* neg = nullptr) const;
 
@@ -41,6 +68,8 @@ public:
 
     Int& operator=(Int const& rhs);
 
+    Int& operator=(Int&& rhs) noexcept;
+
     Int operator-(Int const& rhs) const;
     Int operator+(Int const& rhs) const;
     Int operator*(Int const& rhs) const;
@@ -79,14 +108,206 @@ public:
     friend bool operator>=(Int const& lhs, Int const& rhs);
 
 private:
-    std::unique_ptr<Impl> impl_;
+    enum class BinOp { Sub, Add, Mul, Div, Mod, Xor, And, Or };
+
+    static Int FromSmall(int64_t val)
+    {
+        Int i;
+        i.small_ = val;
+        return i;
+    }
+
+    static bool AddOverflow(int64_t a, int64_t b, int64_t* r);
+    static bool SubOverflow(int64_t a, int64_t b, int64_t* r);
+    static bool MulOverflow(int64_t a, int64_t b, int64_t* r);
+
+    static int CompareSlow(Int const& lhs, Int const& rhs);
+
+    /// Make an integer from a GMP integer, it is stored inline when the value fits
+    static Int FromImpl(Impl impl);
+
+    bool IsSmall() const { return !impl_; }
+
+    /// Get the value as a GMP integer
+    Impl ToImpl() const;
+
+    Int BinOpSlow(Int const& rhs, BinOp op) const;
+
+    Int ShiftSlow(int rhs, bool left) const;
+
+    /// Value of the integer when it is not promoted to GMP
+    int64_t small_ { 0 };
+    /// The GMP integer, nullptr while the value is stored in `small_`
+    std::unique_ptr<Impl, ImplDeleter> impl_;
 };
 
-bool operator==(Int const& lhs, Int const& rhs);
-bool operator<(Int const& lhs, Int const& rhs);
-bool operator<=(Int const& lhs, Int const& rhs);
-bool operator>(Int const& lhs, Int const& rhs);
-bool operator>=(Int const& lhs, Int const& rhs);
+inline bool Int::AddOverflow(int64_t a, int64_t b, int64_t* r)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_add_overflow(a, b, r);
+#else
+    if ((b > 0 && a > std::numeric_limits<int64_t>::max() - b)
+        || (b < 0 && a < std::numeric_limits<int64_t>::min() - b)) {
+        return true;
+    }
+    *r = a + b;
+    return false;
+#endif
+}
+
+inline bool Int::SubOverflow(int64_t a, int64_t b, int64_t* r)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_sub_overflow(a, b, r);
+#else
+    if ((b < 0 && a > std::numeric_limits<int64_t>::max() + b)
+        || (b > 0 && a < std::numeric_limits<int64_t>::min() + b)) {
+        return true;
+    }
+    *r = a - b;
+    return false;
+#endif
+}
+
+inline bool Int::MulOverflow(int64_t a, int64_t b, int64_t* r)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_mul_overflow(a, b, r);
+#else
+    // Both operands in 32 bits can never overflow, leave the others to GMP
+    int64_t const LIMIT = std::numeric_limits<int32_t>::max();
+    if (a > LIMIT || a < -LIMIT || b > LIMIT || b < -LIMIT) {
+        return true;
+    }
+    *r = a * b;
+    return false;
+#endif
+}
+
+inline Int Int::operator-(Int const& rhs) const
+{
+    int64_t r;
+    if (IsSmall() && rhs.IsSmall() && !SubOverflow(small_, rhs.small_, &r)) {
+        return FromSmall(r);
+    }
+    return BinOpSlow(rhs, BinOp::Sub);
+}
+
+inline Int Int::operator+(Int const& rhs) const
+{
+    int64_t r;
+    if (IsSmall() && rhs.IsSmall() && !AddOverflow(small_, rhs.small_, &r)) {
+        return FromSmall(r);
+    }
+    return BinOpSlow(rhs, BinOp::Add);
+}
+
+inline Int Int::operator*(Int const& rhs) const
+{
+    int64_t r;
+    if (IsSmall() && rhs.IsSmall() && !MulOverflow(small_, rhs.small_, &r)) {
+        return FromSmall(r);
+    }
+    return BinOpSlow(rhs, BinOp::Mul);
+}
+
+inline Int Int::operator/(Int const& rhs) const
+{
+    // Division by zero and the only overflowing division go to GMP
+    if (IsSmall() && rhs.IsSmall() && rhs.small_ != 0
+        && !(small_ == std::numeric_limits<int64_t>::min() && rhs.small_ == -1)) {
+        return FromSmall(small_ / rhs.small_);
+    }
+    return BinOpSlow(rhs, BinOp::Div);
+}
+
+inline Int Int::operator%(Int const& rhs) const
+{
+    if (IsSmall() && rhs.IsSmall() && rhs.small_ != 0
+        && !(small_ == std::numeric_limits<int64_t>::min() && rhs.small_ == -1)) {
+        return FromSmall(small_ % rhs.small_);
+    }
+    return BinOpSlow(rhs, BinOp::Mod);
+}
+
+inline Int Int::operator^(Int const& rhs) const
+{
+    if (IsSmall() && rhs.IsSmall()) {
+        return FromSmall(small_ ^ rhs.small_);
+    }
+    return BinOpSlow(rhs, BinOp::Xor);
+}
+
+inline Int Int::operator&(Int const& rhs) const
+{
+    if (IsSmall() && rhs.IsSmall()) {
+        return FromSmall(small_ & rhs.small_);
+    }
+    return BinOpSlow(rhs, BinOp::And);
+}
+
+inline Int Int::operator|(Int const& rhs) const
+{
+    if (IsSmall() && rhs.IsSmall()) {
+        return FromSmall(small_ | rhs.small_);
+    }
+    return BinOpSlow(rhs, BinOp::Or);
+}
+
+inline Int Int::operator<<(int rhs) const
+{
+    if (IsSmall() && rhs >= 0 && rhs < 62) {
+        int64_t const limit = static_cast<int64_t>(1) << (62 - rhs);
+        if (small_ < limit && small_ > -limit) {
+            return FromSmall(small_ * (static_cast<int64_t>(1) << rhs));
+        }
+    }
+    return ShiftSlow(rhs, true);
+}
+
+inline Int Int::operator>>(int rhs) const
+{
+    // Arithmetic shift, it rounds towards negative infinity like GMP does
+    if (IsSmall() && rhs >= 0) {
+        if (rhs >= 63) {
+            return FromSmall(small_ < 0 ? -1 : 0);
+        }
+        return FromSmall(small_ >> rhs);
+    }
+    return ShiftSlow(rhs, false);
+}
+
+inline Int Int::operator~() const
+{
+    if (IsSmall()) {
+        return FromSmall(~small_);
+    }
+    return BinOpSlow(Int(-1), BinOp::Xor);
+}
+
+inline bool operator==(Int const& lhs, Int const& rhs)
+{
+    if (lhs.IsSmall() && rhs.IsSmall()) {
+        return lhs.small_ == rhs.small_;
+    }
+    return Int::CompareSlow(lhs, rhs) == 0;
+}
+
+inline bool operator!=(Int const& lhs, Int const& rhs) { return !(lhs == rhs); }
+
+inline bool operator<(Int const& lhs, Int const& rhs)
+{
+    if (lhs.IsSmall() && rhs.IsSmall()) {
+        return lhs.small_ < rhs.small_;
+    }
+    return Int::CompareSlow(lhs, rhs) < 0;
+}
+
+inline bool operator<=(Int const& lhs, Int const& rhs) { return !(rhs < lhs); }
+
+inline bool operator>(Int const& lhs, Int const& rhs) { return rhs < lhs; }
+
+inline bool operator>=(Int const& lhs, Int const& rhs) { return !(lhs < rhs); }
 
 } // namespace chia
 
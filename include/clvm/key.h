@@ -70,6 +70,18 @@ public:
     /// Calculate the address from public key
     Address GetAddress(std::string_view prefix = "xch") const;
 
+    /**
+     * Derive the wallet keys of a range of indexes and calculate their standard
+     * puzzle hashes, see `puzzle::public_keys_to_puzzle_hashes`
+     *
+     * @param start The first index
+     * @param end The index after the last one
+     * @param unhardened Same as `GetWalletKey`
+     *
+     * @return The puzzle hashes in the order of the indexes
+     */
+    std::vector<Bytes32> GetWalletPuzzleHashes(uint32_t start, uint32_t end, bool unhardened = false) const;
+
 private:
     PrivateKey priv_key_;
 };
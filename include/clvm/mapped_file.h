@@ -0,0 +1,45 @@
+#ifndef CHIA_MAPPED_FILE_H
+#define CHIA_MAPPED_FILE_H
+
+#include <memory>
+#include <string>
+
+#include "types.h"
+
+namespace chia
+{
+
+/// A file mapped into memory read-only, the mapping is released when the object is destroyed
+class MappedFile
+{
+public:
+    /**
+     * Map a whole file into memory
+     *
+     * @param file_path The path of the file
+     *
+     * @return The mapped file, it is shared so atoms can keep it alive while they refer to it
+     */
+    static std::shared_ptr<MappedFile> Open(std::string const& file_path);
+
+    ~MappedFile();
+
+    MappedFile(MappedFile const&) = delete;
+
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    BytesView GetView() const { return BytesView(static_cast<uint8_t const*>(data_), size_); }
+
+private:
+    MappedFile() = default;
+
+    void* data_ { nullptr };
+    std::size_t size_ { 0 };
+#ifdef _WIN32
+    void* mapping_ { nullptr };
+#endif
+};
+
+} // namespace chia
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef CHIA_OPERATOR_LOOKUP_H
 #define CHIA_OPERATOR_LOOKUP_H
 
+#include <array>
 #include <functional>
 #include <map>
 #include <string>
@@ -11,7 +12,10 @@
 namespace chia
 {
 
-using OpFunc = std::function<std::tuple<Cost, CLVMObjectPtr>(CLVMObjectPtr args)>;
+using OpFunc = std::tuple<Cost, CLVMObjectPtr> (*)(CLVMObjectPtr args);
+
+/// An operator which may carry state, e.g. a lambda with captures
+using OpFunction = std::function<std::tuple<Cost, CLVMObjectPtr>(CLVMObjectPtr args)>;
 
 class Ops
 {
@@ -20,7 +24,7 @@ public:
 
     void Assign(std::string op_name, OpFunc f);
 
-    OpFunc Query(std::string op_name);
+    OpFunc Query(std::string op_name) const;
 
 private:
     Ops();
@@ -34,12 +38,25 @@ class OperatorLookup
 public:
     using Keywords = std::vector<std::string>;
 
+    /// The default operators shared by the whole process, it is built on the first call
+    static OperatorLookup const& GetInstance();
+
     Bytes QUOTE_ATOM;
     Bytes APPLY_ATOM;
 
     OperatorLookup();
 
-    std::tuple<Cost, CLVMObjectPtr> operator()(Bytes const& op, CLVMObjectPtr args) const;
+    /**
+     * Replace the operator of a single byte opcode
+     *
+     * @param atom The opcode
+     * @param f The operator, a plain function is called through the table and anything else through `std::function`,
+     * an empty one makes the opcode unknown
+     */
+    void Assign(uint8_t atom, OpFunction f);
+
+    /// Call the operator, an unknown operator raises an error in strict mode
+    std::tuple<Cost, CLVMObjectPtr> operator()(BytesView op, CLVMObjectPtr args, bool strict = false) const;
 
     std::string AtomToKeyword(uint8_t a) const;
 
@@ -54,8 +71,14 @@ private:
 
     void InitKeywords();
 
+    void InitOpTable();
+
 private:
     std::map<uint8_t, Keywords> atom_to_keywords_;
+    /// Operators indexed by the single byte opcode, an empty slot goes to the unknown operator
+    std::array<OpFunc, 256> op_table_ {};
+    /// Operators carrying state, only looked up when the slot of the table is empty
+    std::map<uint8_t, OpFunction> op_functions_;
 };
 
 } // namespace chia
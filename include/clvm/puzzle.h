@@ -2,6 +2,8 @@
 #define CHIA_PUZZLE_UTILS_H
 
 #include <map>
+#include <shared_mutex>
+#include <string>
 
 #include "types.h"
 
@@ -20,12 +22,44 @@ public:
 
     static PredefinedPrograms& GetInstance();
 
-    Program operator[](Names name) const;
+    /// Make a registry of the predefined programs, `GetInstance` is the one used by the library
+    PredefinedPrograms();
+
+    /// The programs are parsed once, the reference is valid for the lifetime of the process
+    Program const& operator[](Names name) const;
+
+    /// The tree hash of a predefined program, it is calculated once
+    Bytes32 const& GetTreeHash(Names name) const;
+
+    /**
+     * Register an additional program, it is safe to be called while other
+     * threads look the programs up
+     *
+     * @param name The name to look the program up, it must not be registered already
+     * @param prog The program
+     */
+    void Register(std::string name, Program prog);
+
+    Program const& operator[](std::string const& name) const;
+
+    Bytes32 const& GetTreeHash(std::string const& name) const;
 
 private:
-    PredefinedPrograms();
+    struct Entry {
+        explicit Entry(Program prog) : prog(std::move(prog)), tree_hash(this->prog.GetTreeHash()) {}
+
+        Program prog;
+        Bytes32 tree_hash;
+    };
 
-    std::map<Names, Bytes> progs_;
+    Entry const& GetEntry(Names name) const;
+
+    Entry const& GetEntry(std::string const& name) const;
+
+    std::map<Names, Entry> progs_;
+    /// The entries are never removed, a reference to one stays valid after the lock is released
+    mutable std::shared_mutex registered_progs_mutex_;
+    std::map<std::string, Entry> registered_progs_;
 };
 
 PublicKey calculate_synthetic_public_key(PublicKey const& public_key, Bytes32 const& hidden_puzzle_hash);
@@ -42,6 +76,9 @@ Program puzzle_for_public_key(PublicKey const& public_key);
 
 Bytes32 public_key_to_puzzle_hash(PublicKey const& public_key);
 
+/// Same as `public_key_to_puzzle_hash` for each key, the calls into bls are serial and the hashing is spread over all cores
+std::vector<Bytes32> public_keys_to_puzzle_hashes(std::vector<PublicKey> const& public_keys);
+
 Program solution_for_conditions(CLVMObjectPtr conditions);
 
 CLVMObjectPtr puzzle_for_conditions(CLVMObjectPtr conditions);
@@ -1,12 +1,15 @@
 #ifndef CHIA_PROGRAM_H
 #define CHIA_PROGRAM_H
 
+#include <atomic>
 #include <functional>
+#include <istream>
 #include <memory>
 #include <optional>
-#include <stack>
 #include <stdexcept>
+#include <type_traits>
 
+#include "allocator.h"
 #include "int.h"
 #include "types.h"
 
@@ -42,6 +45,35 @@ private:
     NodeType type_ { NodeType::None };
 };
 
+/// Bytes of an atom, the short ones are kept inside the node and only the long ones are allocated from the heap
+class AtomStorage
+{
+public:
+    /// Large enough for opcodes, amounts, hashes and G1 elements
+    static std::size_t const INLINE_SIZE = 48;
+
+    AtomStorage() = default;
+
+    explicit AtomStorage(BytesView bytes);
+
+    explicit AtomStorage(Bytes bytes);
+
+    /// Refer to the bytes kept alive by `owner` instead of copying them, short atoms are still copied inline
+    AtomStorage(std::shared_ptr<void const> owner, BytesView bytes);
+
+    BytesView GetView() const { return BytesView(size_ <= INLINE_SIZE ? inline_ : heap_.get(), size_); }
+
+    std::size_t GetSize() const { return size_; }
+
+    bool IsInline() const { return size_ <= INLINE_SIZE; }
+
+private:
+    uint8_t inline_[INLINE_SIZE];
+    /// Bytes of a long atom, the pointer shares the ownership of whatever holds them
+    std::shared_ptr<uint8_t const> heap_;
+    std::size_t size_ { 0 };
+};
+
 class CLVMObject_Atom : public CLVMObject
 {
 public:
@@ -49,6 +81,11 @@ public:
 
     explicit CLVMObject_Atom(Bytes bytes);
 
+    explicit CLVMObject_Atom(BytesView bytes);
+
+    /// Make an atom from the bytes kept alive by `owner`, see `AtomStorage`
+    CLVMObject_Atom(std::shared_ptr<void const> owner, BytesView bytes);
+
     explicit CLVMObject_Atom(std::string str);
 
     explicit CLVMObject_Atom(long i);
@@ -63,7 +100,11 @@ public:
 
     Bytes GetBytes() const;
 
-    bool IsNeg() const { return neg_; }
+    /// View the bytes without copying, it is valid while the atom is alive
+    BytesView GetView() const { return bytes_.GetView(); }
+
+    /// The sign bit of the integer value, integers are stored as two's complement bytes
+    bool IsNeg() const { return bytes_.GetSize() != 0 && (GetView()[0] & 0x80) != 0; }
 
     std::string AsString() const;
 
@@ -74,8 +115,7 @@ public:
     PublicKey AsG1Element() const;
 
 private:
-    bool neg_ { false };
-    Bytes bytes_;
+    AtomStorage bytes_;
 };
 
 class CLVMObject_Pair : public CLVMObject
@@ -83,19 +123,34 @@ class CLVMObject_Pair : public CLVMObject
 public:
     CLVMObject_Pair(CLVMObjectPtr first, CLVMObjectPtr rest, NodeType type);
 
-    CLVMObjectPtr GetFirstNode() const;
+    /// The pairs below are released without recursion, a deep tree doesn't overflow the stack
+    ~CLVMObject_Pair() override;
 
-    CLVMObjectPtr GetRestNode() const;
+    CLVMObjectPtr const& GetFirstNode() const;
 
-    void SetRestNode(CLVMObjectPtr rest);
+    CLVMObjectPtr const& GetRestNode() const;
 
     bool IsFalse() const override { return false; }
 
     bool EqualsTo(CLVMObjectPtr rhs) const override;
 
+    /**
+     * Get the tree hash kept by the pair
+     *
+     * @param out The tree hash is written here when it is available
+     *
+     * @return false when the tree hash has not been calculated yet
+     */
+    bool GetCachedTreeHash(Bytes32& out) const;
+
+    /// Keep the tree hash of the pair, it is written only once even when several threads hash the same tree
+    void SetCachedTreeHash(Bytes32 const& hash) const;
+
 private:
     CLVMObjectPtr first_;
     CLVMObjectPtr rest_;
+    /// Allocated once the pair is hashed, a pair never hashed only pays for the pointer
+    mutable std::atomic<Bytes32 const*> tree_hash_ { nullptr };
 };
 
 bool IsAtom(CLVMObjectPtr obj);
@@ -106,6 +161,9 @@ bool IsNull(CLVMObjectPtr obj);
 
 Bytes ToBytes(CLVMObjectPtr obj);
 
+/// View the bytes of an atom without copying, the view is valid while the atom is alive
+BytesView ToBytesView(CLVMObjectPtr const& obj);
+
 Int ToInt(CLVMObjectPtr obj);
 
 std::string ToString(CLVMObjectPtr obj);
@@ -122,34 +180,48 @@ int ListLen(CLVMObjectPtr list);
 
 CLVMObjectPtr ToSExp(CLVMObjectPtr obj);
 
-template <typename T> CLVMObjectPtr ToSExp(T&& val) { return std::make_shared<CLVMObject_Atom>(std::forward<T>(val)); }
+/// Make an integer atom, the atoms of small integers are shared instances
+CLVMObjectPtr ToSExpInt(Int const& i);
+
+/// Make an atom of a single byte, the atoms of all bytes are shared instances
+CLVMObjectPtr ToSExpByte(uint8_t b);
+
+template <typename T> CLVMObjectPtr ToSExp(T&& val)
+{
+    using Type = std::decay_t<T>;
+    if constexpr (std::is_same_v<Type, Int>) {
+        return ToSExpInt(val);
+    } else if constexpr (std::is_integral_v<Type> && !std::is_same_v<Type, bool>) {
+        return ToSExpInt(Int(static_cast<long>(val)));
+    } else {
+        return MakeShared<CLVMObject_Atom>(std::forward<T>(val));
+    }
+}
 
+/// Collect the items of a list, the pairs are made when the list is asked for and never changed after that
 class ListBuilder
 {
 public:
     void Add(CLVMObjectPtr obj)
     {
-        if (!next_) {
-            // Prepare root_
-            root_ = next_ = std::make_shared<CLVMObject_Pair>(obj, MakeNull(), NodeType::List);
-            return;
-        }
-        auto next_pair = std::static_pointer_cast<CLVMObject_Pair>(next_);
-        next_ = std::make_shared<CLVMObject_Pair>(obj, MakeNull(), NodeType::List);
-        next_pair->SetRestNode(next_);
+        items_.push_back(std::move(obj));
+        root_.reset();
     }
 
     CLVMObjectPtr GetRoot() const
     {
-        if (root_) {
-            return root_;
+        if (!root_) {
+            root_ = MakeNull();
+            for (auto i = items_.rbegin(); i != items_.rend(); ++i) {
+                root_ = MakeShared<CLVMObject_Pair>(*i, root_, NodeType::List);
+            }
         }
-        return MakeNull();
+        return root_;
     }
 
 private:
-    CLVMObjectPtr root_;
-    CLVMObjectPtr next_;
+    std::vector<CLVMObjectPtr> items_;
+    mutable CLVMObjectPtr root_;
 };
 
 inline void BuildList(ListBuilder&) { }
@@ -169,7 +241,7 @@ template <typename... T> CLVMObjectPtr ToSExpList(T&&... vals)
 
 template <typename T1, typename T2> CLVMObjectPtr ToSExpPair(T1&& val1, T2&& val2)
 {
-    return std::make_shared<CLVMObject_Pair>(ToSExp(val1), ToSExp(val2), NodeType::Tuple);
+    return MakeShared<CLVMObject_Pair>(ToSExp(val1), ToSExp(val2), NodeType::Tuple);
 }
 
 CLVMObjectPtr ToTrue();
@@ -197,7 +269,8 @@ public:
         auto n = NextCLVMObj();
         auto val = ToInt(n);
         if (num_bytes) {
-            *num_bytes = val.NumBytes();
+            // The length of the atom, a two's complement integer might take one more byte than its magnitude
+            *num_bytes = static_cast<int>(ToBytesView(n).size());
         }
         return val;
     }
@@ -206,6 +279,9 @@ public:
 
     Bytes Next() { return ToBytes(NextCLVMObj()); }
 
+    /// View the next atom, the atom is owned by the argument list
+    BytesView NextView() { return ToBytesView(NextCLVMObj()); }
+
     CLVMObjectPtr NextCLVMObj()
     {
         CLVMObjectPtr a, n;
@@ -229,15 +305,17 @@ using StreamReadFunc = std::function<Bytes(int size)>;
 template <typename T> class Stack
 {
 public:
-    void Push(T op) { stack_.push(std::move(op)); }
+    void Reserve(std::size_t n) { stack_.reserve(n); }
+
+    void Push(T op) { stack_.push_back(std::move(op)); }
 
     T Pop()
     {
         if (stack_.empty()) {
             throw std::runtime_error("stack is empty");
         }
-        T res = stack_.top();
-        stack_.pop();
+        T res = std::move(stack_.back());
+        stack_.pop_back();
         return res;
     }
 
@@ -246,7 +324,7 @@ public:
         if (stack_.empty()) {
             throw std::runtime_error("no last item");
         }
-        return stack_.top();
+        return stack_.back();
     }
 
     bool IsEmpty() const { return stack_.empty(); }
@@ -262,7 +340,7 @@ public:
     }
 
 private:
-    std::stack<T> stack_;
+    std::vector<T> stack_;
 };
 
 class ValStack : public Stack<CLVMObjectPtr>
@@ -281,15 +359,121 @@ using ReadStreamFunc = std::function<Bytes(int size)>;
 
 CLVMObjectPtr SExpFromStream(ReadStreamFunc f);
 
+struct RunStats {
+    /// Total cost of the run
+    Cost cost { 0 };
+    /// Number of steps the interpreter has taken
+    uint64_t num_steps { 0 };
+    /// Number of bytes allocated for the nodes of the run
+    uint64_t num_allocated_bytes { 0 };
+};
+
+struct RunOptions {
+    RunOptions() = default;
+
+    explicit RunOptions(Cost max_cost)
+        : max_cost(max_cost)
+    {
+    }
+
+    /// The run is stopped with an exception once the cost goes over it, 0 means unlimited
+    Cost max_cost { 0 };
+
+    /// Operators used by the run, nullptr means `OperatorLookup::GetInstance()`
+    OperatorLookup const* operator_lookup { nullptr };
+
+    /// Mempool mode, unknown operators raise an error instead of being charged and ignored
+    bool strict { false };
+
+    /// Receives the statistics when the run ends, also when it is stopped by an exception
+    RunStats* stats { nullptr };
+};
+
+/**
+ * Limits and switches of an import, the defaults are used when no options are
+ * passed, so a program larger than 64 MiB or nested deeper than 1M pairs is
+ * rejected unless `max_size` or `max_depth` is raised or set to 0
+ */
+struct ImportOptions {
+    /// Size of the buffer a stream is read into, larger atoms are collected from it chunk by chunk
+    std::size_t buffer_size { 64 * 1024 };
+
+    /// The import fails once more bytes than this are read, 0 means unlimited
+    std::size_t max_size { 64 * 1024 * 1024 };
+
+    /// The import fails when pairs are nested deeper than this, 0 means unlimited
+    std::size_t max_depth { 1024 * 1024 };
+
+    /// Accept the back references (0xfe) to the subtrees read before, see `Program::SerializeWithBackrefs`
+    bool allow_backrefs { false };
+};
+
+/**
+ * Find the length of the first serialized program in a buffer without building
+ * it, the encoding and the limits are checked the same as an import does
+ *
+ * @param bytes The buffer starts with a serialized program, it might be followed by more bytes
+ * @param options The limits, `buffer_size` is not used
+ *
+ * @return The number of bytes of the program
+ */
+std::size_t SerializedLength(BytesView bytes, ImportOptions const& options = {});
+
+/**
+ * Calculate the tree hash of a serialized program without building it, the
+ * result equals to `Program::GetTreeHash` of the imported program
+ *
+ * @param bytes The buffer starts with a serialized program, back references are not accepted
+ *
+ * @return The tree hash
+ */
+Bytes32 TreeHashFromSerialized(BytesView bytes);
+
+/**
+ * Calculate the tree hash of a curried program from the hashes only, the
+ * result equals to the tree hash of `Program::Curry`
+ *
+ * @param mod_hash The tree hash of the program to be curried
+ * @param arg_hashes The tree hashes of the arguments in order
+ *
+ * @return The tree hash of the curried program
+ */
+Bytes32 CurryTreeHash(Bytes32 const& mod_hash, std::vector<Bytes32> const& arg_hashes);
+
 class Program
 {
 public:
-    static Program ImportFromBytes(Bytes const& bytes);
+    /// Load a serialized program, the default options limit it to 64 MiB and 1M nested pairs
+    static Program ImportFromBytes(Bytes const& bytes, ImportOptions const& options = {});
+
+    /**
+     * Read a serialized program incrementally through a fixed size buffer
+     *
+     * @param in The stream to read, the bytes after the program might be consumed into the buffer
+     * @param options The size of the buffer and the limits of the program, by default 64 MiB and 1M nested pairs
+     *
+     * @return The program
+     */
+    static Program ImportFromStream(std::istream& in, ImportOptions const& options = {});
+
+    /// Same as `ImportFromStream`, the bytes are read from a file descriptor which is left open
+    static Program ImportFromFd(int fd, ImportOptions const& options = {});
 
     static Program ImportFromHex(std::string hex);
 
     static Program ImportFromCompiledFile(std::string file_path);
 
+    /**
+     * Load a program serialized in binary by mapping the file into memory, the
+     * long atoms refer to the mapping which stays alive as long as they do
+     *
+     * @param file_path The path of the file, it contains the raw serialized bytes, not hex
+     * @param options The limits of the program, by default 64 MiB and 1M nested pairs
+     *
+     * @return The program
+     */
+    static Program ImportFromMappedFile(std::string file_path, ImportOptions const& options = {});
+
     static Program ImportFromAssemble(std::string str);
 
     explicit Program(CLVMObjectPtr sexp);
@@ -308,9 +492,43 @@ public:
 
     Bytes Serialize() const;
 
+    /// Append the serialized program to `out`, the buffer can be reused to write more programs
+    void Serialize(Bytes& out) const;
+
+    /**
+     * Serialize the program in the compressed format, a subtree which has been
+     * written before is replaced by a back reference (0xfe) followed by the path
+     * to it, when the reference is shorter than the subtree
+     *
+     * @return The bytes, they are read back with `ImportOptions::allow_backrefs`
+     */
+    Bytes SerializeWithBackrefs() const;
+
     std::tuple<Cost, CLVMObjectPtr> Run(CLVMObjectPtr args = MakeNull()) const;
 
-    Program Curry(CLVMObjectPtr args);
+    std::tuple<Cost, CLVMObjectPtr> Run(CLVMObjectPtr args, RunOptions const& options) const;
+
+    /// Curry a single argument into the program, see the overload below
+    Program Curry(CLVMObjectPtr args) const;
+
+    /**
+     * Curry the arguments into the program, the result is built directly and
+     * it is the same as running the curry program of clvm, that is
+     * `(a (q . program) (c (q . arg1) (c (q . arg2) ... 1)))`
+     *
+     * @param args The arguments in order, the first one is the first argument of the program
+     *
+     * @return The curried program
+     */
+    Program Curry(std::vector<CLVMObjectPtr> const& args) const;
+
+    /**
+     * Split a curried program back into the program and the arguments, only the
+     * structure is matched, nothing is run
+     *
+     * @return The program and the arguments in order, or nothing when the program is not in the curried form
+     */
+    std::optional<std::tuple<Program, std::vector<CLVMObjectPtr>>> Uncurry() const;
 
 private:
     Program() { }
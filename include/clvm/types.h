@@ -1,7 +1,9 @@
 #ifndef CHIA_TYPES_H
 #define CHIA_TYPES_H
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 #include <array>
 #include <string>
@@ -16,6 +18,58 @@ using Bytes48 = std::array<uint8_t, 48>;
 using Bytes64 = std::array<uint8_t, 64>;
 using Bytes96 = std::array<uint8_t, 96>;
 
+/// Non-owning view of contiguous bytes, the memory it refers to must outlive the view
+class BytesView
+{
+public:
+    BytesView() = default;
+
+    BytesView(uint8_t const* data, std::size_t size)
+        : data_(data)
+        , size_(size)
+    {
+    }
+
+    BytesView(Bytes const& bytes)
+        : data_(bytes.data())
+        , size_(bytes.size())
+    {
+    }
+
+    template <std::size_t N>
+    BytesView(std::array<uint8_t, N> const& bytes)
+        : data_(bytes.data())
+        , size_(N)
+    {
+    }
+
+    uint8_t const* data() const { return data_; }
+
+    std::size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    uint8_t const* begin() const { return data_; }
+
+    uint8_t const* end() const { return data_ + size_; }
+
+    uint8_t operator[](std::size_t i) const { return data_[i]; }
+
+    /// Copy the bytes out of the view
+    Bytes ToBytes() const { return Bytes(begin(), end()); }
+
+private:
+    uint8_t const* data_ { nullptr };
+    std::size_t size_ { 0 };
+};
+
+inline bool operator==(BytesView lhs, BytesView rhs)
+{
+    return lhs.size() == rhs.size() && (lhs.empty() || memcmp(lhs.data(), rhs.data(), lhs.size()) == 0);
+}
+
+inline bool operator!=(BytesView lhs, BytesView rhs) { return !(lhs == rhs); }
+
 using PrivateKey = Bytes32;
 using PublicKey = Bytes48;
 using Signature = Bytes96;
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cstring>
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -208,6 +209,19 @@ std::string ToUpper(std::string str);
 
 std::string ToLower(std::string str);
 
+/**
+ * Call `f` for each index in [0, count) from the threads of all cores, the
+ * indexes are handed out one by one so the work should not be too small
+ *
+ * @param count The number of indexes
+ * @param f The function to call, it must be safe to be called concurrently
+ * @param min_count_per_thread A thread is only started for each this many indexes, a small count runs on the caller
+ *
+ * The first exception thrown by `f` is thrown again after all threads have finished
+ */
+void ParallelFor(
+    std::size_t count, std::function<void(std::size_t index)> const& f, std::size_t min_count_per_thread = 1);
+
 } // namespace chia::utils
 
 #endif
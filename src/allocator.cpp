@@ -0,0 +1,89 @@
+#include "clvm/allocator.h"
+
+#include <algorithm>
+#include <new>
+
+namespace chia
+{
+
+static thread_local Allocator* current_allocator { nullptr };
+
+void AllocatorReleaser::operator()(Allocator* allocator) const { allocator->Release(); }
+
+Allocator* Allocator::GetCurrent() { return current_allocator; }
+
+AllocatorPtr Allocator::Create() { return AllocatorPtr(new Allocator()); }
+
+void* Allocator::Allocate(std::size_t size, std::size_t align)
+{
+    if (!IsPooled(size, align)) {
+        return ::operator new(size, std::align_val_t(align));
+    }
+    std::size_t index = (std::max<std::size_t>(size, 1) - 1) / GRANULE_SIZE;
+    void* p;
+    if (free_lists_[index]) {
+        FreeNode* node = free_lists_[index];
+        free_lists_[index] = node->next;
+        p = node;
+    } else {
+        p = AllocateFromBlock((index + 1) * GRANULE_SIZE);
+    }
+    used_ += (index + 1) * GRANULE_SIZE;
+    ++num_live_;
+    return p;
+}
+
+void Allocator::Deallocate(void* p, std::size_t size, std::size_t align)
+{
+    if (!IsPooled(size, align)) {
+        ::operator delete(p, std::align_val_t(align));
+        return;
+    }
+    if (released_) {
+        if (num_remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+        return;
+    }
+    std::size_t index = (std::max<std::size_t>(size, 1) - 1) / GRANULE_SIZE;
+    FreeNode* node = static_cast<FreeNode*>(p);
+    node->next = free_lists_[index];
+    free_lists_[index] = node;
+    --num_live_;
+}
+
+void* Allocator::AllocateFromBlock(std::size_t size)
+{
+    if (size > left_) {
+        // Blocks start small for short runs and double up to `MAX_BLOCK_SIZE`, the tail of the previous block is
+        // dropped, it is less than `MAX_NODE_SIZE`
+        std::size_t block_size = std::min(MIN_BLOCK_SIZE << std::min<std::size_t>(blocks_.size(), 4), MAX_BLOCK_SIZE);
+        blocks_.emplace_back(new uint8_t[block_size]);
+        cursor_ = blocks_.back().get();
+        left_ = block_size;
+        reserved_ += block_size;
+    }
+    void* p = cursor_;
+    cursor_ += size;
+    left_ -= size;
+    return p;
+}
+
+void Allocator::Release()
+{
+    released_ = true;
+    num_remaining_.store(num_live_, std::memory_order_release);
+    if (num_live_ == 0) {
+        delete this;
+    }
+}
+
+AllocatorScope::AllocatorScope(Allocator* allocator)
+    : prev_(current_allocator)
+{
+    current_allocator = allocator;
+}
+
+AllocatorScope::~AllocatorScope() { current_allocator = prev_; }
+
+} // namespace chia
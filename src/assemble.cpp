@@ -382,7 +382,8 @@ CLVMObjectPtr tokenize_sexp(std::string token, int offset, stream::TokenStream&
         return tokenize_cons(token, offset, stream);
     }
 
-    auto funcs = { tokenize_int, tokenize_hex, tokenize_quotes, tokenize_symbol };
+    // A `0x` token is raw bytes, it must be tried before the integer which would add a sign byte to it
+    auto funcs = { tokenize_hex, tokenize_int, tokenize_quotes, tokenize_symbol };
     for (auto& f : funcs) {
         auto r = f(token, offset);
         if (r) {
@@ -401,10 +402,9 @@ CLVMObjectPtr assemble_from_ir(CLVMObjectPtr ir_sexp)
         if (keyword[0] == '#') {
             keyword = keyword.substr(1);
         }
-        OperatorLookup lookup;
         try {
-            uint8_t atom = lookup.KeywordToAtom(keyword);
-            return ToSExp(utils::ByteToBytes(atom));
+            uint8_t atom = OperatorLookup::GetInstance().KeywordToAtom(keyword);
+            return ToSExpByte(atom);
         } catch (std::exception const& e) {
             return ir_val(ir_sexp);
         }
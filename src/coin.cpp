@@ -61,11 +61,11 @@ std::vector<ConditionWithArgs> parse_sexp_to_conditions(CLVMObjectPtr sexp)
 }
 
 std::tuple<std::vector<ConditionWithArgs>, uint64_t> conditions_for_solution(
-    Program const& puzzle_reveal, Program const& solution, uint64_t max_cost)
+    Program const& puzzle_reveal, Program const& solution, RunOptions const& run_options)
 {
     Cost cost;
     CLVMObjectPtr r;
-    std::tie(cost, r) = puzzle_reveal.Run(solution.GetSExp());
+    std::tie(cost, r) = puzzle_reveal.Run(solution.GetSExp(), run_options);
     auto results = parse_sexp_to_conditions(r);
     return std::make_tuple(results, cost);
 }
@@ -103,27 +103,27 @@ std::vector<Coin> created_outputs_for_conditions_dict(
 }
 
 std::tuple<std::map<ConditionOpcode, std::vector<ConditionWithArgs>>, Cost> conditions_dict_for_solution(
-    Program const& puzzle_reveal, Program const& solution, Cost max_cost)
+    Program const& puzzle_reveal, Program const& solution, RunOptions const& run_options)
 {
     std::vector<ConditionWithArgs> results;
     Cost cost;
-    std::tie(results, cost) = conditions_for_solution(puzzle_reveal, solution, max_cost);
+    std::tie(results, cost) = conditions_for_solution(puzzle_reveal, solution, run_options);
     return std::make_tuple(conditions_by_opcode(results), cost);
 }
 
-std::vector<Coin> additions_for_solution(Bytes32 coin_name, Program const& puzzle_reveal, Program const& solution, Cost max_cost)
+std::vector<Coin> additions_for_solution(Bytes32 coin_name, Program const& puzzle_reveal, Program const& solution, RunOptions const& run_options)
 {
     std::map<chia::ConditionOpcode, std::vector<chia::ConditionWithArgs>> dic;
     Cost cost;
-    std::tie(dic, cost) = conditions_dict_for_solution(puzzle_reveal, solution, max_cost);
+    std::tie(dic, cost) = conditions_dict_for_solution(puzzle_reveal, solution, run_options);
     return created_outputs_for_conditions_dict(dic, coin_name);
 }
 
-Cost fee_for_solution(Program const& puzzle_reveal, Program const& solution, Cost max_cost)
+Cost fee_for_solution(Program const& puzzle_reveal, Program const& solution, RunOptions const& run_options)
 {
     std::map<chia::ConditionOpcode, std::vector<chia::ConditionWithArgs>> dic;
     Cost cost;
-    std::tie(dic, cost) = conditions_dict_for_solution(puzzle_reveal, solution, max_cost);
+    std::tie(dic, cost) = conditions_dict_for_solution(puzzle_reveal, solution, run_options);
     if (dic.empty()) {
         return 0;
     }
@@ -207,13 +207,13 @@ Program make_solution(std::vector<Payment> const& primaries, std::set<Bytes> con
     return solution_for_conditions(condition_list.GetRoot());
 }
 
-std::vector<Payment> decode_payments_from_solution(Program puzzle_reveal, Program const& solution, Cost max_cost, Cost* pout_cost)
+std::vector<Payment> decode_payments_from_solution(Program puzzle_reveal, Program const& solution, RunOptions const& run_options, Cost* pout_cost)
 {
     std::vector<Payment> result;
 
     Cost cost;
     std::vector<ConditionWithArgs> conditions;
-    std::tie(conditions, cost) = conditions_for_solution(puzzle_reveal, solution, max_cost);
+    std::tie(conditions, cost) = conditions_for_solution(puzzle_reveal, solution, run_options);
     if (pout_cost) {
         *pout_cost = cost;
     }
@@ -233,7 +233,7 @@ std::vector<Payment> decode_payments_from_solution(Program puzzle_reveal, Progra
     return result;
 }
 
-SpendBundle sign_coin_spends(std::vector<CoinSpend> coin_spends, SecretKeyForPublicKeyFunc secret_key_for_public_key_f, SecretKeyForPuzzleHashFunc secret_key_for_puzzle_hash_f, Bytes const& additional_data, Cost max_cost, std::vector<DeriveFunc> const& derive_f_list)
+SpendBundle sign_coin_spends(std::vector<CoinSpend> coin_spends, SecretKeyForPublicKeyFunc secret_key_for_public_key_f, SecretKeyForPuzzleHashFunc secret_key_for_puzzle_hash_f, Bytes const& additional_data, RunOptions const& run_options, std::vector<DeriveFunc> const& derive_f_list)
 {
     std::vector<chia::Signature> signatures;
     std::vector<chia::PublicKey> public_key_list;
@@ -246,7 +246,7 @@ SpendBundle sign_coin_spends(std::vector<CoinSpend> coin_spends, SecretKeyForPub
         std::map<chia::ConditionOpcode, std::vector<chia::ConditionWithArgs>> conditions_dict;
         Cost cost;
         std::tie(conditions_dict, cost)
-            = conditions_dict_for_solution(coin_spend.puzzle_reveal.value(), coin_spend.solution.value(), max_cost);
+            = conditions_dict_for_solution(coin_spend.puzzle_reveal.value(), coin_spend.solution.value(), run_options);
         if (conditions_dict.empty()) {
             throw std::runtime_error("Sign transaction failed");
         }
@@ -349,10 +349,10 @@ CoinSpend::CoinSpend(Coin in_coin, Program in_puzzle_reveal, Program in_solution
 
 std::vector<Coin> CoinSpend::Additions() const
 {
-    return puzzle::additions_for_solution(coin.GetName(), puzzle_reveal.value(), solution.value(), INFINITE_COST);
+    return puzzle::additions_for_solution(coin.GetName(), puzzle_reveal.value(), solution.value(), RunOptions(MAX_BLOCK_COST_CLVM));
 }
 
-Cost CoinSpend::ReservedFee() { return puzzle::fee_for_solution(puzzle_reveal.value(), solution.value(), INFINITE_COST); }
+Cost CoinSpend::ReservedFee() { return puzzle::fee_for_solution(puzzle_reveal.value(), solution.value(), RunOptions(MAX_BLOCK_COST_CLVM)); }
 
 /*******************************************************************************
  *
@@ -63,11 +63,11 @@ OpResult op_eq(CLVMObjectPtr args)
     if (IsPair(a0) || IsPair(a1)) {
         throw std::runtime_error("= on list");
     }
-    auto b0 = ToBytes(a0);
-    auto b1 = ToBytes(a1);
+    BytesView b0 = ToBytesView(a0);
+    BytesView b1 = ToBytesView(a1);
     Cost cost { EQ_BASE_COST };
     cost += (b0.size() + b1.size()) * EQ_COST_PER_BYTE;
-    return std::make_tuple(cost, a0->EqualsTo(a1) ? ToTrue() : ToFalse());
+    return std::make_tuple(cost, b0 == b1 ? ToTrue() : ToFalse());
 }
 
 } // namespace chia
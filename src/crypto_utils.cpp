@@ -22,9 +22,9 @@ namespace crypto_utils
 #include <CommonCrypto/CommonCrypto.h>
 
 struct SHA256::Impl {
-    void Add(Bytes const& buff)
+    void Add(BytesView buff)
     {
-        m_buff = utils::ConnectBuffers(m_buff, buff);
+        m_buff.insert(std::end(m_buff), std::begin(buff), std::end(buff));
     }
 
     void Finish(uint8_t* pout)
@@ -58,7 +58,7 @@ struct SHA256::Impl {
         EVP_MD_CTX_destroy(ctx_);
     }
 
-    void Add(Bytes const& buff)
+    void Add(BytesView buff)
     {
         _C(EVP_DigestUpdate(ctx_, buff.data(), buff.size()));
     }
@@ -84,6 +84,8 @@ SHA256::~SHA256() {}
 
 void SHA256::Add(Bytes const& bytes) { m_pimpl->Add(bytes); }
 
+void SHA256::Add(BytesView bytes) { m_pimpl->Add(bytes); }
+
 Bytes32 SHA256::Finish()
 {
     Bytes32 res;
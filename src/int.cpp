@@ -2,9 +2,7 @@
 
 #include <gmpxx.h>
 
-#include <sstream>
-
-#include "clvm/utils.h"
+#include <limits>
 
 namespace chia
 {
@@ -59,169 +57,270 @@ bool check_valid_int(std::string s)
     return check_valid_int_string(s);
 }
 
-std::tuple<std::string, bool> strip_sign(std::string s)
-{
-    if (s.empty()) {
-        return std::make_tuple("", false);
-    }
-
-    if (s[0] == '+' || s[0] == '-') {
-        return std::make_tuple(std::string(s.substr(1)), s[0] == '-');
-    }
-
-    return std::make_tuple(std::string(s), false);
-}
-
 struct Impl {
     mpz_class mpz;
 };
 
 bool Int::IsValidNumberStr(std::string s) { return check_valid_int(s); }
 
-std::unique_ptr<Impl> create_impl_from_mpz(mpz_class mpz) { return std::unique_ptr<Impl>(new Impl({ mpz })); }
+void ImplDeleter::operator()(Impl* impl) const { delete impl; }
 
-Int::Int() { }
-
-Int::~Int() { }
-
-Int::Int(Int const& rhs)
-    : impl_(new Impl({ rhs.impl_->mpz }))
+std::unique_ptr<Impl, ImplDeleter> create_impl_from_mpz(mpz_class mpz)
 {
+    return std::unique_ptr<Impl, ImplDeleter>(new Impl({ std::move(mpz) }));
 }
 
-Int::Int(std::string s, int base) { impl_.reset(new Impl { mpz_class(std::string(s), base) }); }
+uint64_t small_abs(int64_t val) { return val < 0 ? 0 - static_cast<uint64_t>(val) : static_cast<uint64_t>(val); }
 
-Int::Int(Bytes const& s, bool neg)
+mpz_class small_to_mpz(int64_t val)
 {
-    std::stringstream ss;
-    ss << "0x" << utils::BytesToHex(s);
-    mpz_class mpz(ss.str());
-    if (neg) {
-        mpz *= -1;
+    if (val >= std::numeric_limits<long>::min() && val <= std::numeric_limits<long>::max()) {
+        return mpz_class(static_cast<long>(val));
+    }
+    // `long` is only 32 bits on some platforms, import the magnitude instead
+    uint64_t abs_val = small_abs(val);
+    mpz_class mpz;
+    mpz_import(mpz.get_mpz_t(), 1, -1, sizeof(abs_val), 0, 0, &abs_val);
+    if (val < 0) {
+        mpz = -mpz;
     }
-    impl_ = create_impl_from_mpz(std::move(mpz));
+    return mpz;
 }
 
-Int::Int(long val)
+Int Int::FromImpl(Impl impl)
 {
-    mpz_class mpz(val);
-    impl_ = create_impl_from_mpz(std::move(mpz));
+    mpz_class& mpz = impl.mpz;
+    Int i;
+    if (mpz_sizeinbase(mpz.get_mpz_t(), 2) <= 63) {
+        uint64_t abs_val { 0 };
+        mpz_export(&abs_val, nullptr, -1, sizeof(abs_val), 0, 0, mpz.get_mpz_t());
+        i.small_ = mpz_sgn(mpz.get_mpz_t()) < 0 ? -static_cast<int64_t>(abs_val) : static_cast<int64_t>(abs_val);
+    } else {
+        i.impl_ = create_impl_from_mpz(std::move(mpz));
+    }
+    return i;
 }
 
-Bytes Int::ToBytes(bool* neg) const
+Impl Int::ToImpl() const
 {
-    std::string hex = impl_->mpz.get_str(16);
-    std::string r;
-    bool neg2;
-    std::tie(r, neg2) = strip_sign(hex);
-    if (neg) {
-        *neg = neg2;
+    if (IsSmall()) {
+        return Impl { small_to_mpz(small_) };
     }
-    return utils::BytesFromHex(r);
+    return *impl_;
 }
 
-int Int::NumBytes() const { return static_cast<int>(ToBytes().size()); }
+Int::~Int() { }
 
-int Int::ToInt() const { return static_cast<int>(impl_->mpz.get_si()); }
+Int::Int(Int const& rhs)
+    : small_(rhs.small_)
+{
+    if (rhs.impl_) {
+        impl_ = create_impl_from_mpz(rhs.impl_->mpz);
+    }
+}
 
-unsigned long Int::ToUInt() const { return impl_->mpz.get_ui(); }
+Int::Int(Int&& rhs) noexcept
+    : small_(rhs.small_)
+    , impl_(std::move(rhs.impl_))
+{
+}
 
-Int Int::Abs() const
+Int::Int(std::string s, int base)
+    : Int(FromImpl({ mpz_class(std::string(s), base) }))
 {
-    mpz_class mpz = abs(impl_->mpz);
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
 }
 
-Int& Int::operator=(Int const& rhs)
+Int::Int(Bytes const& s, bool neg)
 {
-    if (this != &rhs) {
-        impl_ = create_impl_from_mpz(rhs.impl_->mpz);
+    if (s.size() <= sizeof(uint64_t)) {
+        uint64_t abs_val { 0 };
+        for (uint8_t b : s) {
+            abs_val = (abs_val << 8) | b;
+        }
+        if (abs_val <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+            small_ = neg ? -static_cast<int64_t>(abs_val) : static_cast<int64_t>(abs_val);
+            return;
+        }
     }
-    return *this;
+    mpz_class mpz;
+    mpz_import(mpz.get_mpz_t(), s.size(), 1, 1, 1, 0, s.data());
+    if (neg) {
+        mpz = -mpz;
+    }
+    *this = FromImpl({ std::move(mpz) });
 }
 
-Int Int::operator-(Int const& rhs) const
+Int Int::FromSignedBytes(uint8_t const* data, std::size_t size)
 {
-    mpz_class mpz = impl_->mpz - rhs.impl_->mpz;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    if (size == 0) {
+        return Int();
+    }
+    bool neg = (data[0] & 0x80) != 0;
+    if (size <= sizeof(uint64_t)) {
+        // Start from all ones for a negative value, the bits left of the bytes are the sign extension
+        uint64_t val = neg ? ~static_cast<uint64_t>(0) : 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            val = (val << 8) | data[i];
+        }
+        return FromSmall(static_cast<int64_t>(val));
+    }
+    mpz_class mpz;
+    mpz_import(mpz.get_mpz_t(), size, 1, 1, 1, 0, data);
+    if (neg) {
+        mpz -= mpz_class(1) << static_cast<mp_bitcnt_t>(size * 8);
+    }
+    return FromImpl({ std::move(mpz) });
 }
 
-Int Int::operator+(Int const& rhs) const
+Bytes Int::ToSignedBytes() const
 {
-    mpz_class mpz = impl_->mpz + rhs.impl_->mpz;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    if (IsSmall()) {
+        if (small_ == 0) {
+            return {};
+        }
+        // The bits of a negative value are counted from its complement, one more bit is taken by the sign
+        uint64_t val = static_cast<uint64_t>(small_);
+        uint64_t bits = small_ < 0 ? ~val : val;
+        int num_bits { 1 };
+        for (; bits != 0; bits >>= 1) {
+            ++num_bits;
+        }
+        Bytes res((num_bits + 7) / 8);
+        for (auto i = res.rbegin(); i != res.rend(); ++i) {
+            *i = static_cast<uint8_t>(val & 0xff);
+            val >>= 8;
+        }
+        return res;
+    }
+    mpz_class const& mpz = impl_->mpz;
+    if (mpz_sgn(mpz.get_mpz_t()) > 0) {
+        std::size_t num_bits = mpz_sizeinbase(mpz.get_mpz_t(), 2);
+        // A leading zero byte is required when the highest bit is set
+        Bytes res(num_bits / 8 + 1);
+        mpz_export(res.data() + res.size() - (num_bits + 7) / 8, nullptr, 1, 1, 1, 0, mpz.get_mpz_t());
+        return res;
+    }
+    mpz_class complement = -mpz - 1;
+    std::size_t num_bits = mpz_sizeinbase(complement.get_mpz_t(), 2) + 1;
+    std::size_t num_bytes = (num_bits + 7) / 8;
+    // Add 2^(8 * num_bytes) to get the bytes of the negative value
+    mpz_class val = mpz + (mpz_class(1) << static_cast<mp_bitcnt_t>(num_bytes * 8));
+    Bytes res(num_bytes);
+    mpz_export(res.data(), nullptr, 1, 1, 1, 0, val.get_mpz_t());
+    return res;
 }
 
-Int Int::operator*(Int const& rhs) const
+Bytes Int::ToBytes(bool* neg) const
 {
-    mpz_class mpz = impl_->mpz * rhs.impl_->mpz;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    Bytes res(NumBytes());
+    if (IsSmall()) {
+        if (neg) {
+            *neg = small_ < 0;
+        }
+        uint64_t abs_val = small_abs(small_);
+        for (auto i = res.rbegin(); i != res.rend(); ++i) {
+            *i = static_cast<uint8_t>(abs_val & 0xff);
+            abs_val >>= 8;
+        }
+        return res;
+    }
+    if (neg) {
+        *neg = mpz_sgn(impl_->mpz.get_mpz_t()) < 0;
+    }
+    // The absolute value is exported in big-endian
+    mpz_export(res.data(), nullptr, 1, 1, 1, 0, impl_->mpz.get_mpz_t());
+    return res;
 }
 
-Int Int::operator/(Int const& rhs) const
+int Int::NumBytes() const
 {
-    mpz_class mpz = impl_->mpz / rhs.impl_->mpz;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    if (IsSmall()) {
+        int num_bytes { 0 };
+        for (uint64_t abs_val = small_abs(small_); abs_val != 0; abs_val >>= 8) {
+            ++num_bytes;
+        }
+        return num_bytes;
+    }
+    // A promoted value is never zero, `mpz_sizeinbase` is exact for base 2
+    return static_cast<int>((mpz_sizeinbase(impl_->mpz.get_mpz_t(), 2) + 7) / 8);
 }
 
-Int Int::operator%(Int const& rhs) const
+int Int::ToInt() const
 {
-    mpz_class mpz = impl_->mpz % rhs.impl_->mpz;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    if (IsSmall()) {
+        return static_cast<int>(small_);
+    }
+    return static_cast<int>(impl_->mpz.get_si());
 }
 
-Int Int::operator^(Int const& rhs) const
+unsigned long Int::ToUInt() const
 {
-    mpz_class mpz = impl_->mpz ^ rhs.impl_->mpz;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    if (IsSmall()) {
+        // Same as GMP, the absolute value is returned
+        return static_cast<unsigned long>(small_abs(small_));
+    }
+    return impl_->mpz.get_ui();
 }
 
-Int Int::operator&(Int const& rhs) const
+Int Int::Abs() const
 {
-    mpz_class mpz = impl_->mpz & rhs.impl_->mpz;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    if (IsSmall() && small_ != std::numeric_limits<int64_t>::min()) {
+        return FromSmall(small_ < 0 ? -small_ : small_);
+    }
+    return FromImpl({ abs(ToImpl().mpz) });
 }
 
-Int Int::operator|(Int const& rhs) const
+Int& Int::operator=(Int const& rhs)
 {
-    mpz_class mpz = impl_->mpz | rhs.impl_->mpz;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    if (this != &rhs) {
+        small_ = rhs.small_;
+        impl_ = rhs.impl_ ? create_impl_from_mpz(rhs.impl_->mpz) : nullptr;
+    }
+    return *this;
 }
 
-Int Int::operator<<(int rhs) const
+Int& Int::operator=(Int&& rhs) noexcept
 {
-    mpz_class mpz = impl_->mpz << rhs;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    small_ = rhs.small_;
+    impl_ = std::move(rhs.impl_);
+    return *this;
 }
 
-Int Int::operator>>(int rhs) const
+Int Int::BinOpSlow(Int const& rhs, BinOp op) const
+{
+    mpz_class lhs_mpz = ToImpl().mpz;
+    mpz_class rhs_mpz = rhs.ToImpl().mpz;
+    switch (op) {
+    case BinOp::Sub:
+        return FromImpl({ lhs_mpz - rhs_mpz });
+    case BinOp::Add:
+        return FromImpl({ lhs_mpz + rhs_mpz });
+    case BinOp::Mul:
+        return FromImpl({ lhs_mpz * rhs_mpz });
+    case BinOp::Div:
+        return FromImpl({ lhs_mpz / rhs_mpz });
+    case BinOp::Mod:
+        return FromImpl({ lhs_mpz % rhs_mpz });
+    case BinOp::Xor:
+        return FromImpl({ lhs_mpz ^ rhs_mpz });
+    case BinOp::And:
+        return FromImpl({ lhs_mpz & rhs_mpz });
+    case BinOp::Or:
+        return FromImpl({ lhs_mpz | rhs_mpz });
+    }
+    throw std::runtime_error("unknown binary operation");
+}
+
+Int Int::ShiftSlow(int rhs, bool left) const
 {
-    mpz_class mpz = impl_->mpz >> rhs;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(mpz));
-    return i;
+    if (left) {
+        return FromImpl({ ToImpl().mpz << rhs });
+    }
+    return FromImpl({ ToImpl().mpz >> rhs });
 }
 
+int Int::CompareSlow(Int const& lhs, Int const& rhs) { return cmp(lhs.ToImpl().mpz, rhs.ToImpl().mpz); }
+
 Int& Int::operator+=(Int const& rhs)
 {
     *this = *this + rhs;
@@ -308,24 +407,4 @@ Int& Int::operator--()
     return *this;
 }
 
-Int Int::operator~() const
-{
-    auto new_mpz = ~impl_->mpz;
-    Int i;
-    i.impl_ = create_impl_from_mpz(std::move(new_mpz));
-    return i;
-}
-
-bool operator==(Int const& lhs, Int const& rhs) { return lhs.impl_->mpz == rhs.impl_->mpz; }
-
-bool operator!=(Int const& lhs, Int const& rhs) { return !(lhs == rhs); }
-
-bool operator<(Int const& lhs, Int const& rhs) { return lhs.impl_->mpz < rhs.impl_->mpz; }
-
-bool operator<=(Int const& lhs, Int const& rhs) { return lhs.impl_->mpz <= rhs.impl_->mpz; }
-
-bool operator>(Int const& lhs, Int const& rhs) { return lhs.impl_->mpz > rhs.impl_->mpz; }
-
-bool operator>=(Int const& lhs, Int const& rhs) { return lhs.impl_->mpz >= rhs.impl_->mpz; }
-
 } // namespace chia
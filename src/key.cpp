@@ -156,6 +156,20 @@ Address Key::GetAddress(std::string_view prefix) const
     return bech32::EncodePuzzleHash(puzzle_hash, prefix);
 }
 
+std::vector<Bytes32> Key::GetWalletPuzzleHashes(uint32_t start, uint32_t end, bool unhardened) const
+{
+    if (end < start) {
+        throw std::runtime_error("invalid range of the wallet keys");
+    }
+    // The keys are derived by bls on this thread, see `puzzle::public_keys_to_puzzle_hashes`
+    std::vector<PublicKey> public_keys;
+    public_keys.reserve(end - start);
+    for (uint32_t index = start; index < end; ++index) {
+        public_keys.push_back(GetWalletKey(index, unhardened).GetPublicKey());
+    }
+    return puzzle::public_keys_to_puzzle_hashes(public_keys);
+}
+
 } // namespace wallet
 
 } // namespace chia
@@ -0,0 +1,104 @@
+#include "clvm/mapped_file.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace chia
+{
+
+[[noreturn]] void throw_open_error(std::string const& file_path)
+{
+    std::stringstream ss;
+    ss << "cannot map file: " << file_path;
+    throw std::runtime_error(ss.str());
+}
+
+#ifdef _WIN32
+
+std::shared_ptr<MappedFile> MappedFile::Open(std::string const& file_path)
+{
+    HANDLE file = CreateFileA(
+        file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw_open_error(file_path);
+    }
+    std::shared_ptr<MappedFile> mapped_file(new MappedFile());
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        throw_open_error(file_path);
+    }
+    mapped_file->size_ = static_cast<std::size_t>(size.QuadPart);
+    if (mapped_file->size_ > 0) {
+        // An empty file cannot be mapped, it is represented by an empty view
+        mapped_file->mapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapped_file->mapping_) {
+            mapped_file->data_ = MapViewOfFile(mapped_file->mapping_, FILE_MAP_READ, 0, 0, 0);
+        }
+    }
+    CloseHandle(file);
+    if (mapped_file->size_ > 0 && !mapped_file->data_) {
+        throw_open_error(file_path);
+    }
+    return mapped_file;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+    }
+}
+
+#else
+
+std::shared_ptr<MappedFile> MappedFile::Open(std::string const& file_path)
+{
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw_open_error(file_path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw_open_error(file_path);
+    }
+    std::shared_ptr<MappedFile> mapped_file(new MappedFile());
+    mapped_file->size_ = static_cast<std::size_t>(st.st_size);
+    if (mapped_file->size_ > 0) {
+        // An empty file cannot be mapped, it is represented by an empty view
+        void* data = mmap(nullptr, mapped_file->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            mapped_file->data_ = data;
+        }
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (mapped_file->size_ > 0 && !mapped_file->data_) {
+        throw_open_error(file_path);
+    }
+    return mapped_file;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_) {
+        munmap(data_, size_);
+    }
+}
+
+#endif
+
+} // namespace chia
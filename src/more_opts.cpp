@@ -28,7 +28,7 @@ OpResult op_sha256(CLVMObjectPtr args)
     int arg_len { 0 };
     ArgsIter iter(args);
     while (!iter.IsEof()) {
-        Bytes b = iter.Next();
+        BytesView b = iter.NextView();
         sha256.Add(b);
         arg_len += static_cast<int>(b.size());
         cost += SHA256_COST_PER_ARG;
@@ -113,7 +113,7 @@ OpResult op_divmod(CLVMObjectPtr args)
     std::tie(q, r) = divmod(i0, i1);
     auto q1 = ToSExp(q);
     auto r1 = ToSExp(r);
-    cost += (ToBytes(q1).size() + ToBytes(r1).size()) * MALLOC_COST_PER_BYTE;
+    cost += (ToBytesView(q1).size() + ToBytesView(r1).size()) * MALLOC_COST_PER_BYTE;
     return std::make_tuple(cost, ToSExpPair(q1, r1));
 }
 
@@ -205,7 +205,7 @@ OpResult op_strlen(CLVMObjectPtr args)
     if (ListLen(args) != 1) {
         throw std::runtime_error("strlen takes exactly 1 argument");
     }
-    auto a0 = ToBytes(First(args));
+    BytesView a0 = ToBytesView(First(args));
     Int size(static_cast<long>(a0.size()));
     Cost cost = a0.size() * STRLEN_COST_PER_BYTE + STRLEN_BASE_COST;
     return MallocCost(cost, ToSExp(size));
@@ -219,12 +219,12 @@ OpResult op_substr(CLVMObjectPtr args)
         throw std::runtime_error("substr takes exactly 2 or 3 arguments");
     }
     auto s0 = arg_list[0];
-    int i1 = Int(arg_list[1]).ToInt();
+    int i1 = Int::FromSignedBytes(arg_list[1]).ToInt();
     int i2 { 0 };
     if (arg_count == 2) {
         i2 = static_cast<int>(s0.size());
     } else {
-        i2 = Int(arg_list[2]).ToInt();
+        i2 = Int::FromSignedBytes(arg_list[2]).ToInt();
     }
     if (i2 > s0.size() || i2 < i1 || i2 < 0 || i1 < 0) {
         throw std::runtime_error("invalid indices for substr");
@@ -1,6 +1,5 @@
 #include "clvm/operator_lookup.h"
 
-#include <iostream>
 #include <algorithm>
 
 #include "clvm/core_opts.h"
@@ -50,19 +49,19 @@ std::map<std::string, std::string> OP_REWRITE = {
     { ">s", "gr_bytes" },
 };
 
-std::tuple<Cost, CLVMObjectPtr> default_unknown_op(Bytes const& op, CLVMObjectPtr args)
+std::tuple<Cost, CLVMObjectPtr> default_unknown_op(BytesView op, CLVMObjectPtr args)
 {
     if (op.empty() || (op.size() > 2 && op[0] == 0xff && op[1] == 0xff)) {
         throw std::runtime_error("reserved operator");
     }
 
-    Cost cost_function = (*op.rbegin() & 0b11000000) >> 6;
+    Cost cost_function = (op[op.size() - 1] & 0b11000000) >> 6;
 
     if (op.size() > 5) {
         throw std::runtime_error("invalid operator");
     }
 
-    Cost cost_multiplier = Int(utils::ByteToBytes(*op.rbegin())).ToInt() + 1;
+    Cost cost_multiplier = Int(utils::ByteToBytes(op[op.size() - 1])).ToInt() + 1;
 
     Cost cost { 0 };
     if (cost_function == 0) {
@@ -117,11 +116,11 @@ Ops& Ops::GetInstance()
 
 void Ops::Assign(std::string op_name, OpFunc f) { ops_[op_name.data()] = std::move(f); }
 
-OpFunc Ops::Query(std::string op_name)
+OpFunc Ops::Query(std::string op_name) const
 {
     auto i = ops_.find(op_name.data());
     if (i == std::end(ops_)) {
-        return OpFunc(); // an empty op indicates the op cannot be found
+        return nullptr; // an empty op indicates the op cannot be found
     }
     return i->second;
 }
@@ -162,27 +161,48 @@ Ops::Ops()
     Assign("softfork", op_softfork);
 }
 
+OperatorLookup const& OperatorLookup::GetInstance()
+{
+    static OperatorLookup const instance;
+    return instance;
+}
+
 OperatorLookup::OperatorLookup()
 {
     InitKeywords();
+    InitOpTable();
     QUOTE_ATOM = utils::ByteToBytes(KeywordToAtom("q"));
     APPLY_ATOM = utils::ByteToBytes(KeywordToAtom("a"));
 }
 
-std::tuple<Cost, CLVMObjectPtr> OperatorLookup::operator()(Bytes const& op, CLVMObjectPtr args) const
+void OperatorLookup::Assign(uint8_t atom, OpFunction f)
 {
-    try {
-        Keywords keywords = AtomToKeywords(op[0]);
-        for (std::string const& keyword : keywords) {
-            auto op_f = Ops::GetInstance().Query(keyword);
-            if (op_f) {
-                return op_f(args);
+    op_functions_.erase(atom);
+    OpFunc const* op_f = f.target<OpFunc>();
+    op_table_[atom] = op_f ? *op_f : nullptr;
+    if (f && !op_f) {
+        op_functions_.emplace(atom, std::move(f));
+    }
+}
+
+std::tuple<Cost, CLVMObjectPtr> OperatorLookup::operator()(BytesView op, CLVMObjectPtr args, bool strict) const
+{
+    if (op.size() == 1) {
+        OpFunc op_f = op_table_[op[0]];
+        if (op_f) {
+            return op_f(args);
+        }
+        if (!op_functions_.empty()) {
+            auto i = op_functions_.find(op[0]);
+            if (i != std::end(op_functions_)) {
+                return i->second(args);
             }
         }
-    } catch (std::exception const& e) {
-        std::cerr << e.what() << std::endl;
     }
-    std::cerr << "unknown op 0x" << utils::BytesToHex(op) << std::endl;
+    // Multi-byte opcodes and single byte opcodes without an implementation
+    if (strict) {
+        throw std::runtime_error("unimplemented operator");
+    }
     return default_unknown_op(op, args);
 }
 
@@ -230,6 +250,20 @@ void OperatorLookup::AddKeyword(uint8_t atom, std::string keyword)
     atom_to_keywords_.emplace(std::make_pair(atom, keywords));
 }
 
+void OperatorLookup::InitOpTable()
+{
+    Ops const& ops = Ops::GetInstance();
+    for (auto const& entry : atom_to_keywords_) {
+        for (std::string const& keyword : entry.second) {
+            OpFunc op_f = ops.Query(keyword);
+            if (op_f) {
+                op_table_[entry.first] = op_f;
+                break;
+            }
+        }
+    }
+}
+
 void OperatorLookup::InitKeywords()
 {
     std::string::size_type start { 0 };
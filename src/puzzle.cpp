@@ -3,7 +3,9 @@
 #include <cassert>
 
 #include <map>
+#include <mutex>
 
+#include "clvm/allocator.h"
 #include "clvm/crypto_utils.h"
 #include "clvm/types.h"
 #include "clvm/utils.h"
@@ -20,31 +22,85 @@ PredefinedPrograms& PredefinedPrograms::GetInstance()
     return instance;
 }
 
-Program PredefinedPrograms::operator[](Names name) const
+Program const& PredefinedPrograms::operator[](Names name) const
+{
+    return GetEntry(name).prog;
+}
+
+Bytes32 const& PredefinedPrograms::GetTreeHash(Names name) const
+{
+    return GetEntry(name).tree_hash;
+}
+
+void PredefinedPrograms::Register(std::string name, Program prog)
+{
+    // The tree hash is calculated before the lock is taken, it is kept for the lifetime of the registry so it doesn't
+    // come from the arena of a run
+    AllocatorScope heap_scope(nullptr);
+    Entry entry(std::move(prog));
+    std::unique_lock<std::shared_mutex> lock(registered_progs_mutex_);
+    if (registered_progs_.find(name) != std::cend(registered_progs_)) {
+        throw std::runtime_error("the program has been registered already, name: " + name);
+    }
+    registered_progs_.emplace(std::move(name), std::move(entry));
+}
+
+Program const& PredefinedPrograms::operator[](std::string const& name) const
+{
+    return GetEntry(name).prog;
+}
+
+Bytes32 const& PredefinedPrograms::GetTreeHash(std::string const& name) const
+{
+    return GetEntry(name).tree_hash;
+}
+
+PredefinedPrograms::PredefinedPrograms() {
+    // The instance might be made by an operator in the middle of a run, the programs outlive the arena of the run
+    AllocatorScope heap_scope(nullptr);
+    auto add = [this](Names name, char const* hex) {
+        progs_.emplace(name, Entry(Program::ImportFromBytes(utils::BytesFromHex(hex))));
+    };
+    add(Names::DEFAULT_HIDDEN_PUZZLE, "ff0980");
+    add(Names::SYNTHETIC_MOD, "ff1dff02ffff1effff0bff02ff05808080");
+    add(Names::MOD, "ff02ffff01ff02ffff03ff0bffff01ff02ffff03ffff09ff05ffff1dff0bffff1effff0bff0bffff02ff06ffff04ff02ffff04ff17ff8080808080808080ffff01ff02ff17ff2f80ffff01ff088080ff0180ffff01ff04ffff04ff04ffff04ff05ffff04ffff02ff06ffff04ff02ffff04ff17ff80808080ff80808080ffff02ff17ff2f808080ff0180ffff04ffff01ff32ff02ffff03ffff07ff0580ffff01ff0bffff0102ffff02ff06ffff04ff02ffff04ff09ff80808080ffff02ff06ffff04ff02ffff04ff0dff8080808080ffff01ff0bffff0101ff058080ff0180ff018080");
+    add(Names::P2_CONDITIONS, "ff04ffff0101ff0280");
+}
+
+PredefinedPrograms::Entry const& PredefinedPrograms::GetEntry(Names name) const
 {
     auto it = progs_.find(name);
     if (it == std::cend(progs_)) {
         throw std::runtime_error("the predefined program doesn't exist, please check the name");
     }
-    return Program::ImportFromBytes(it->second);
+    return it->second;
 }
 
-PredefinedPrograms::PredefinedPrograms() {
-    progs_[Names::DEFAULT_HIDDEN_PUZZLE] = utils::BytesFromHex("ff0980");
-    progs_[Names::SYNTHETIC_MOD] = utils::BytesFromHex("ff1dff02ffff1effff0bff02ff05808080");
-    progs_[Names::MOD] = utils::BytesFromHex("ff02ffff01ff02ffff03ff0bffff01ff02ffff03ffff09ff05ffff1dff0bffff1effff0bff0bffff02ff06ffff04ff02ffff04ff17ff8080808080808080ffff01ff02ff17ff2f80ffff01ff088080ff0180ffff01ff04ffff04ff04ffff04ff05ffff04ffff02ff06ffff04ff02ffff04ff17ff80808080ff80808080ffff02ff17ff2f808080ff0180ffff04ffff01ff32ff02ffff03ffff07ff0580ffff01ff0bffff0102ffff02ff06ffff04ff02ffff04ff09ff80808080ffff02ff06ffff04ff02ffff04ff0dff8080808080ffff01ff0bffff0101ff058080ff0180ff018080");
-    progs_[Names::P2_CONDITIONS] = utils::BytesFromHex("ff04ffff0101ff0280");
+PredefinedPrograms::Entry const& PredefinedPrograms::GetEntry(std::string const& name) const
+{
+    std::shared_lock<std::shared_mutex> lock(registered_progs_mutex_);
+    auto it = registered_progs_.find(name);
+    if (it == std::cend(registered_progs_)) {
+        throw std::runtime_error("the program hasn't been registered, name: " + name);
+    }
+    return it->second;
 }
 
 wallet::Key KeyFromRawPrivateKey(Bytes const& bytes)
 {
     if (bytes.size() < wallet::Key::PRIV_KEY_LEN) {
-        throw std::runtime_error("not enough number of bytes for a private-key");
+        // The leading zeros of an integer are not kept in its bytes
+        Bytes padded(wallet::Key::PRIV_KEY_LEN - bytes.size(), 0);
+        padded.insert(std::end(padded), std::begin(bytes), std::end(bytes));
+        return wallet::Key(utils::bytes_cast<wallet::Key::PRIV_KEY_LEN>(padded));
     }
     auto private_key = utils::bytes_cast<wallet::Key::PRIV_KEY_LEN>(bytes);
     return wallet::Key(private_key);
 }
 
+/// A thread is only started for this many keys, a hash takes a few microseconds
+std::size_t const MIN_HASHES_PER_THREAD = 256;
+
 char const* SZ_GROUP_ORDER = "73EDA753299D7D483339D80809A1D80553BDA402FFFE5BFEFFFFFFFF00000001";
 
 Int GROUP_ORDER()
@@ -60,14 +116,18 @@ Int calculate_synthetic_offset(PublicKey const& public_key, Bytes32 const& hidde
     return offset;
 }
 
-PublicKey calculate_synthetic_public_key(PublicKey const& public_key, Bytes32 const& hidden_puzzle_hash)
+PublicKey synthetic_public_key_from_offset(PublicKey const& public_key, Int const& offset)
 {
-    Int offset = calculate_synthetic_offset(public_key, hidden_puzzle_hash);
     auto bytes = offset.ToBytes();
     wallet::Key synthetic_offset = KeyFromRawPrivateKey(bytes);
     return wallet::Key::AggregatePublicKeys({ public_key, synthetic_offset.GetPublicKey() });
 }
 
+PublicKey calculate_synthetic_public_key(PublicKey const& public_key, Bytes32 const& hidden_puzzle_hash)
+{
+    return synthetic_public_key_from_offset(public_key, calculate_synthetic_offset(public_key, hidden_puzzle_hash));
+}
+
 PrivateKey calculate_synthetic_secret_key(PrivateKey const& private_key, Bytes32 const& hidden_puzzle_hash)
 {
     Int secret_exponent = Int(utils::bytes_cast<wallet::Key::PRIV_KEY_LEN>(private_key));
@@ -100,12 +160,46 @@ Program puzzle_for_public_key_and_hidden_puzzle(PublicKey const& public_key, Pro
 Program puzzle_for_public_key(PublicKey const& public_key)
 {
     return puzzle_for_public_key_and_hidden_puzzle_hash(
-        public_key, PredefinedPrograms::GetInstance()[PredefinedPrograms::Names::DEFAULT_HIDDEN_PUZZLE].GetTreeHash());
+        public_key, PredefinedPrograms::GetInstance().GetTreeHash(PredefinedPrograms::Names::DEFAULT_HIDDEN_PUZZLE));
+}
+
+Bytes32 puzzle_hash_for_synthetic_public_key(PublicKey const& synthetic_public_key)
+{
+    // Only the hashes are required, the curried puzzle is not built
+    return CurryTreeHash(PredefinedPrograms::GetInstance().GetTreeHash(PredefinedPrograms::Names::MOD),
+        { Program(ToSExp(synthetic_public_key)).GetTreeHash() });
 }
 
 Bytes32 public_key_to_puzzle_hash(PublicKey const& public_key)
 {
-    return puzzle_for_public_key(public_key).GetTreeHash();
+    auto synthetic_public_key = calculate_synthetic_public_key(public_key,
+        PredefinedPrograms::GetInstance().GetTreeHash(PredefinedPrograms::Names::DEFAULT_HIDDEN_PUZZLE));
+    return puzzle_hash_for_synthetic_public_key(synthetic_public_key);
+}
+
+std::vector<Bytes32> public_keys_to_puzzle_hashes(std::vector<PublicKey> const& public_keys)
+{
+    // Whether relic can be called from several threads depends on how it is built, so the calls into bls stay on this
+    // thread and only the hashing is spread over the cores
+    Bytes32 const& hidden_puzzle_hash
+        = PredefinedPrograms::GetInstance().GetTreeHash(PredefinedPrograms::Names::DEFAULT_HIDDEN_PUZZLE);
+    std::vector<Int> offsets(public_keys.size());
+    utils::ParallelFor(
+        public_keys.size(),
+        [&public_keys, &hidden_puzzle_hash, &offsets](
+            std::size_t i) { offsets[i] = calculate_synthetic_offset(public_keys[i], hidden_puzzle_hash); },
+        MIN_HASHES_PER_THREAD);
+    std::vector<PublicKey> synthetic_public_keys(public_keys.size());
+    for (std::size_t i = 0; i < public_keys.size(); ++i) {
+        synthetic_public_keys[i] = synthetic_public_key_from_offset(public_keys[i], offsets[i]);
+    }
+    std::vector<Bytes32> puzzle_hashes(public_keys.size());
+    utils::ParallelFor(
+        public_keys.size(),
+        [&synthetic_public_keys, &puzzle_hashes](
+            std::size_t i) { puzzle_hashes[i] = puzzle_hash_for_synthetic_public_key(synthetic_public_keys[i]); },
+        MIN_HASHES_PER_THREAD);
+    return puzzle_hashes;
 }
 
 CLVMObjectPtr puzzle_for_conditions(CLVMObjectPtr conditions)
@@ -1,16 +1,28 @@
 #include "clvm/sexp_prog.h"
 
+#include <cerrno>
+#include <climits>
+
 #include <iostream>
 #include <memory>
 #include <stdexcept>
 #include <algorithm>
 
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "clvm/assemble.h"
 #include "clvm/costs.h"
 #include "clvm/crypto_utils.h"
 #include "clvm/key.h"
+#include "clvm/mapped_file.h"
 #include "clvm/operator_lookup.h"
 #include "clvm/utils.h"
 
@@ -19,6 +31,10 @@ namespace chia
 
 uint8_t const MAX_SINGLE_BYTE = 0x7F;
 uint8_t const CONS_BOX_MARKER = 0xFF;
+uint8_t const BACK_REFERENCE = 0xFE;
+
+long const MIN_INTERNED_INT = -1;
+long const MAX_INTERNED_INT = 255;
 
 std::string NodeTypeToString(NodeType type)
 {
@@ -52,6 +68,38 @@ CLVMObject::CLVMObject(NodeType type)
 {
 }
 
+AtomStorage::AtomStorage(BytesView bytes)
+    : size_(bytes.size())
+{
+    if (IsInline()) {
+        std::copy(std::begin(bytes), std::end(bytes), inline_);
+    } else {
+        auto owner = std::make_shared<Bytes>(bytes.ToBytes());
+        heap_ = std::shared_ptr<uint8_t const>(owner, owner->data());
+    }
+}
+
+AtomStorage::AtomStorage(Bytes bytes)
+    : size_(bytes.size())
+{
+    if (IsInline()) {
+        std::copy(std::begin(bytes), std::end(bytes), inline_);
+    } else {
+        auto owner = std::make_shared<Bytes>(std::move(bytes));
+        heap_ = std::shared_ptr<uint8_t const>(owner, owner->data());
+    }
+}
+
+AtomStorage::AtomStorage(std::shared_ptr<void const> owner, BytesView bytes)
+    : size_(bytes.size())
+{
+    if (IsInline()) {
+        std::copy(std::begin(bytes), std::end(bytes), inline_);
+    } else {
+        heap_ = std::shared_ptr<uint8_t const>(std::move(owner), bytes.data());
+    }
+}
+
 CLVMObject_Atom::CLVMObject_Atom()
     : CLVMObject(NodeType::None)
 {
@@ -63,11 +111,22 @@ CLVMObject_Atom::CLVMObject_Atom(Bytes bytes)
 {
 }
 
+CLVMObject_Atom::CLVMObject_Atom(BytesView bytes)
+    : CLVMObject(NodeType::Atom_Bytes)
+    , bytes_(bytes)
+{
+}
+
+CLVMObject_Atom::CLVMObject_Atom(std::shared_ptr<void const> owner, BytesView bytes)
+    : CLVMObject(NodeType::Atom_Bytes)
+    , bytes_(std::move(owner), bytes)
+{
+}
+
 CLVMObject_Atom::CLVMObject_Atom(std::string str)
     : CLVMObject(NodeType::Atom_Str)
+    , bytes_(BytesView(reinterpret_cast<uint8_t const*>(str.data()), str.size()))
 {
-    bytes_.resize(str.size());
-    memcpy(bytes_.data(), str.data(), str.size());
 }
 
 CLVMObject_Atom::CLVMObject_Atom(long i)
@@ -77,49 +136,48 @@ CLVMObject_Atom::CLVMObject_Atom(long i)
 
 CLVMObject_Atom::CLVMObject_Atom(Int const& i)
     : CLVMObject(NodeType::Atom_Int)
+    , bytes_(i.ToSignedBytes())
 {
-    bytes_ = i.ToBytes(&neg_);
 }
 
 CLVMObject_Atom::CLVMObject_Atom(PublicKey const& g1_element)
     : CLVMObject(NodeType::Atom_G1Element)
+    , bytes_(BytesView(g1_element))
 {
-    bytes_ = utils::bytes_cast<wallet::Key::PUB_KEY_LEN>(g1_element);
 }
 
 bool CLVMObject_Atom::IsFalse() const
 {
-    if (GetNodeType() == NodeType::None) {
-        return true;
-    }
-    if (GetNodeType() == NodeType::Atom_Int) {
-        Int i(bytes_, neg_);
-        return i == Int(0);
-    }
-    return false;
+    // Integer atoms are canonical, zero is stored as empty bytes same as nil
+    return bytes_.GetSize() == 0;
 }
 
 bool CLVMObject_Atom::EqualsTo(CLVMObjectPtr rhs) const
 {
-    if (IsFalse() && rhs->IsFalse()) {
-        return true;
-    }
-    if (GetNodeType() != rhs->GetNodeType()) {
+    if (!IsAtom(rhs)) {
         return false;
     }
-    auto rhs_p = std::static_pointer_cast<CLVMObject_Atom>(rhs);
-    return neg_ == rhs_p->neg_ && bytes_ == rhs_p->bytes_;
+    auto rhs_p = static_cast<CLVMObject_Atom const*>(rhs.get());
+    return GetView() == rhs_p->GetView();
 }
 
-Bytes CLVMObject_Atom::GetBytes() const { return bytes_; }
+Bytes CLVMObject_Atom::GetBytes() const { return GetView().ToBytes(); }
 
-std::string CLVMObject_Atom::AsString() const { return std::string(std::begin(bytes_), std::end(bytes_)); }
+std::string CLVMObject_Atom::AsString() const
+{
+    BytesView view = GetView();
+    return std::string(std::begin(view), std::end(view));
+}
 
-long CLVMObject_Atom::AsLong() const { return Int(bytes_, neg_).ToInt(); }
+long CLVMObject_Atom::AsLong() const { return AsInt().ToInt(); }
 
-Int CLVMObject_Atom::AsInt() const { return Int(bytes_, neg_); }
+Int CLVMObject_Atom::AsInt() const
+{
+    BytesView view = GetView();
+    return Int::FromSignedBytes(view.data(), view.size());
+}
 
-PublicKey CLVMObject_Atom::AsG1Element() const { return utils::bytes_cast<wallet::Key::PUB_KEY_LEN>(bytes_); }
+PublicKey CLVMObject_Atom::AsG1Element() const { return utils::bytes_cast<wallet::Key::PUB_KEY_LEN>(GetBytes()); }
 
 CLVMObject_Pair::CLVMObject_Pair(CLVMObjectPtr first, CLVMObjectPtr rest, NodeType type)
     : CLVMObject(type)
@@ -128,14 +186,62 @@ CLVMObject_Pair::CLVMObject_Pair(CLVMObjectPtr first, CLVMObjectPtr rest, NodeTy
 {
 }
 
-CLVMObjectPtr CLVMObject_Pair::GetFirstNode() const { return first_; }
+CLVMObject_Pair::~CLVMObject_Pair()
+{
+    delete tree_hash_.load(std::memory_order_relaxed);
+    // A child pair only held here is taken out, its children are taken the same way before it goes so it never
+    // destroys another pair. The stack is only used when both sides are taken, a list needs no allocation
+    CLVMObjectPtr next;
+    std::vector<CLVMObjectPtr> stack;
+    auto take = [&next, &stack](CLVMObjectPtr& node) {
+        if (node && node.use_count() == 1
+            && (node->GetNodeType() == NodeType::List || node->GetNodeType() == NodeType::Tuple)) {
+            if (next) {
+                stack.push_back(std::move(node));
+            } else {
+                next = std::move(node);
+            }
+        }
+    };
+    take(first_);
+    take(rest_);
+    while (next) {
+        CLVMObjectPtr node = std::move(next);
+        auto pair = static_cast<CLVMObject_Pair*>(node.get());
+        take(pair->first_);
+        take(pair->rest_);
+        if (!next && !stack.empty()) {
+            next = std::move(stack.back());
+            stack.pop_back();
+        }
+    }
+}
 
-CLVMObjectPtr CLVMObject_Pair::GetRestNode() const { return rest_; }
+CLVMObjectPtr const& CLVMObject_Pair::GetFirstNode() const { return first_; }
 
-void CLVMObject_Pair::SetRestNode(CLVMObjectPtr rest) { rest_ = rest; }
+CLVMObjectPtr const& CLVMObject_Pair::GetRestNode() const { return rest_; }
 
 bool CLVMObject_Pair::EqualsTo(CLVMObjectPtr rhs) const { throw std::runtime_error("cannot compare pairs"); }
 
+bool CLVMObject_Pair::GetCachedTreeHash(Bytes32& out) const
+{
+    Bytes32 const* tree_hash = tree_hash_.load(std::memory_order_acquire);
+    if (tree_hash == nullptr) {
+        return false;
+    }
+    out = *tree_hash;
+    return true;
+}
+
+void CLVMObject_Pair::SetCachedTreeHash(Bytes32 const& hash) const
+{
+    auto tree_hash = std::make_unique<Bytes32>(hash);
+    Bytes32 const* expected { nullptr };
+    if (tree_hash_.compare_exchange_strong(expected, tree_hash.get(), std::memory_order_release)) {
+        tree_hash.release();
+    }
+}
+
 bool IsAtom(CLVMObjectPtr obj)
 {
     if (!obj) {
@@ -156,7 +262,9 @@ bool IsPair(CLVMObjectPtr obj)
 
 bool IsNull(CLVMObjectPtr obj) { return obj->GetNodeType() == NodeType::None; }
 
-Bytes ToBytes(CLVMObjectPtr obj)
+Bytes ToBytes(CLVMObjectPtr obj) { return ToBytesView(obj).ToBytes(); }
+
+BytesView ToBytesView(CLVMObjectPtr const& obj)
 {
     if (!obj) {
         throw std::runtime_error("can't convert null to atom");
@@ -164,20 +272,18 @@ Bytes ToBytes(CLVMObjectPtr obj)
     if (!IsAtom(obj)) {
         throw std::runtime_error("it's not an ATOM");
     }
-    auto atom = static_cast<CLVMObject_Atom*>(obj.get());
-    return atom->GetBytes();
+    auto atom = static_cast<CLVMObject_Atom const*>(obj.get());
+    return atom->GetView();
 }
 
 Int ToInt(CLVMObjectPtr obj)
 {
-    if (IsNull(obj)) {
-        return Int(0);
-    }
-    if (obj->GetNodeType() != NodeType::Atom_Int) {
+    if (!IsAtom(obj)) {
         throw std::runtime_error("it's not an INT");
     }
-    auto int_p = std::static_pointer_cast<CLVMObject_Atom>(obj);
-    return int_p->AsInt();
+    // Any atom can be read as an integer, the bytes are two's complement
+    auto atom = static_cast<CLVMObject_Atom*>(obj.get());
+    return atom->AsInt();
 }
 
 std::string ToString(CLVMObjectPtr obj)
@@ -219,7 +325,45 @@ CLVMObjectPtr Rest(CLVMObjectPtr obj)
     return pair->GetRestNode();
 }
 
-CLVMObjectPtr MakeNull() { return std::make_shared<CLVMObject_Atom>(); }
+/**
+ * Atoms are immutable, so the common ones are created once and shared by every
+ * tree. They are allocated from the heap because an arena only lives as long as
+ * a single run
+ */
+struct InternedAtoms {
+    InternedAtoms()
+        : null(std::make_shared<CLVMObject_Atom>())
+    {
+        for (long i = MIN_INTERNED_INT; i <= MAX_INTERNED_INT; ++i) {
+            ints[i - MIN_INTERNED_INT] = std::make_shared<CLVMObject_Atom>(Int(i));
+        }
+        for (int b = 0; b < 256; ++b) {
+            bytes[b] = std::make_shared<CLVMObject_Atom>(utils::ByteToBytes(static_cast<uint8_t>(b)));
+        }
+    }
+
+    static InternedAtoms const& GetInstance()
+    {
+        static InternedAtoms instance;
+        return instance;
+    }
+
+    CLVMObjectPtr null;
+    CLVMObjectPtr ints[MAX_INTERNED_INT - MIN_INTERNED_INT + 1];
+    CLVMObjectPtr bytes[256];
+};
+
+CLVMObjectPtr MakeNull() { return InternedAtoms::GetInstance().null; }
+
+CLVMObjectPtr ToSExpInt(Int const& i)
+{
+    if (i >= Int(MIN_INTERNED_INT) && i <= Int(MAX_INTERNED_INT)) {
+        return InternedAtoms::GetInstance().ints[i.ToInt() - MIN_INTERNED_INT];
+    }
+    return MakeShared<CLVMObject_Atom>(i);
+}
+
+CLVMObjectPtr ToSExpByte(uint8_t b) { return InternedAtoms::GetInstance().bytes[b]; }
 
 int ListLen(CLVMObjectPtr list)
 {
@@ -241,7 +385,7 @@ CLVMObjectPtr ToSExp(CLVMObjectPtr obj) { return obj; }
 
 CLVMObjectPtr ToTrue() { return ToSExp(1); }
 
-CLVMObjectPtr ToFalse() { return CLVMObjectPtr(new CLVMObject_Atom()); }
+CLVMObjectPtr ToFalse() { return MakeNull(); }
 
 bool ListP(CLVMObjectPtr obj) { return IsPair(obj); }
 
@@ -255,7 +399,7 @@ int ArgsLen(CLVMObjectPtr obj)
             throw std::runtime_error("requires in args");
         }
         // Next
-        len += static_cast<int>(ToBytes(a).size());
+        len += static_cast<int>(ToBytesView(a).size());
         obj = r;
     }
     return len;
@@ -274,7 +418,7 @@ std::tuple<bool, Bytes, CLVMObjectPtr> ArgsNext(CLVMObjectPtr obj)
 
 std::tuple<Cost, CLVMObjectPtr> MallocCost(Cost cost, CLVMObjectPtr atom)
 {
-    return std::make_tuple(cost + ToBytes(atom).size() * MALLOC_COST_PER_BYTE, atom);
+    return std::make_tuple(cost + ToBytesView(atom).size() * MALLOC_COST_PER_BYTE, atom);
 }
 
 std::vector<std::tuple<Int, int>> ListInts(CLVMObjectPtr args)
@@ -316,39 +460,13 @@ class OpStack : public Stack<Op>
 {
 };
 
-class StreamReader
-{
-public:
-    explicit StreamReader(Bytes const& bytes)
-        : bytes_(bytes)
-    {
-    }
-
-    Bytes operator()(int size) const
-    {
-        Bytes res;
-        int read_size = std::min<int>(size, static_cast<int>(bytes_.size() - pos_));
-        if (read_size == 0) {
-            return res;
-        }
-        res.resize(read_size);
-        memcpy(res.data(), bytes_.data() + pos_, read_size);
-        pos_ += read_size;
-        return res;
-    }
-
-private:
-    Bytes const& bytes_;
-    mutable int pos_ { 0 };
-};
-
 CLVMObjectPtr AtomFromStream(StreamReadFunc f, uint8_t b)
 {
     if (b == 0x80) {
         return ToSExp(MakeNull());
     }
     if (b <= MAX_SINGLE_BYTE) {
-        return ToSExp(utils::ByteToBytes(b));
+        return ToSExpByte(b);
     }
     int bit_count { 0 };
     int bit_mask { 0x80 };
@@ -412,141 +530,804 @@ CLVMObjectPtr SExpFromStream(ReadStreamFunc f)
     return val_stack.Pop();
 }
 
-Bytes AtomToBytes(Bytes const& as_atom)
+void WriteAtom(BytesView atom, Bytes& out)
 {
-    uint64_t size = as_atom.size();
+    uint64_t size = atom.size();
     if (size == 0) {
-        return utils::ByteToBytes('\x80');
+        out.push_back(0x80);
+        return;
     }
-    if (size == 1) {
-        if (as_atom[0] <= MAX_SINGLE_BYTE) {
-            return as_atom;
-        }
+    if (size == 1 && atom[0] <= MAX_SINGLE_BYTE) {
+        out.push_back(atom[0]);
+        return;
     }
-    Bytes size_blob;
     if (size < 0x40) {
-        size_blob = utils::ByteToBytes(static_cast<uint8_t>(0x80 | size));
+        out.push_back(static_cast<uint8_t>(0x80 | size));
     } else if (size < 0x2000) {
-        size_blob.push_back(static_cast<uint8_t>(0xC0 | (size >> 8)));
-        size_blob.push_back(static_cast<uint8_t>((size >> 8) & 0xff));
+        out.push_back(static_cast<uint8_t>(0xC0 | (size >> 8)));
+        out.push_back(static_cast<uint8_t>((size >> 0) & 0xFF));
     } else if (size < 0x100000) {
-        size_blob.push_back(static_cast<uint8_t>(0xe0 | (size >> 16)));
-        size_blob.push_back(static_cast<uint8_t>((size >> 8) & 0xff));
-        size_blob.push_back(static_cast<uint8_t>((size >> 0) & 0xff));
+        out.push_back(static_cast<uint8_t>(0xE0 | (size >> 16)));
+        out.push_back(static_cast<uint8_t>((size >> 8) & 0xFF));
+        out.push_back(static_cast<uint8_t>((size >> 0) & 0xFF));
     } else if (size < 0x8000000) {
-        size_blob.push_back(static_cast<uint8_t>(0xF0 | (size >> 24)));
-        size_blob.push_back(static_cast<uint8_t>((size >> 16) & 0xFF));
-        size_blob.push_back(static_cast<uint8_t>((size >> 8) & 0xFF));
-        size_blob.push_back(static_cast<uint8_t>((size >> 0) & 0xFF));
+        out.push_back(static_cast<uint8_t>(0xF0 | (size >> 24)));
+        out.push_back(static_cast<uint8_t>((size >> 16) & 0xFF));
+        out.push_back(static_cast<uint8_t>((size >> 8) & 0xFF));
+        out.push_back(static_cast<uint8_t>((size >> 0) & 0xFF));
     } else if (size < 0x400000000) {
-        size_blob.push_back(static_cast<uint8_t>(0xF8 | (size >> 32)));
-        size_blob.push_back(static_cast<uint8_t>((size >> 24) & 0xFF));
-        size_blob.push_back(static_cast<uint8_t>((size >> 16) & 0xFF));
-        size_blob.push_back(static_cast<uint8_t>((size >> 8) & 0xFF));
-        size_blob.push_back(static_cast<uint8_t>((size >> 0) & 0xFF));
+        out.push_back(static_cast<uint8_t>(0xF8 | (size >> 32)));
+        out.push_back(static_cast<uint8_t>((size >> 24) & 0xFF));
+        out.push_back(static_cast<uint8_t>((size >> 16) & 0xFF));
+        out.push_back(static_cast<uint8_t>((size >> 8) & 0xFF));
+        out.push_back(static_cast<uint8_t>((size >> 0) & 0xFF));
     } else {
         throw std::runtime_error("sexp too long");
     }
-    return utils::ConnectBuffers(size_blob, as_atom);
+    out.insert(std::end(out), std::begin(atom), std::end(atom));
 }
 
-Bytes SExpToStream(CLVMObjectPtr sexp)
+void SExpToStream(CLVMObjectPtr const& sexp, Bytes& out)
 {
-    Bytes res;
-    ValStack todo_stack;
-    todo_stack.Push(sexp);
-
-    while (!todo_stack.IsEmpty()) {
-        CLVMObjectPtr sexp = todo_stack.Pop();
-        if (IsPair(sexp)) {
-            res.push_back(CONS_BOX_MARKER);
-            CLVMObjectPtr first, rest;
-            std::tie(first, rest) = Pair(sexp);
-            todo_stack.Push(rest);
-            todo_stack.Push(first);
+    // The nodes are owned by the tree while it is being written, raw pointers are enough
+    std::vector<CLVMObject const*> todo_stack;
+    todo_stack.push_back(sexp.get());
+
+    while (!todo_stack.empty()) {
+        CLVMObject const* node = todo_stack.back();
+        todo_stack.pop_back();
+        if (node->GetNodeType() == NodeType::List || node->GetNodeType() == NodeType::Tuple) {
+            out.push_back(CONS_BOX_MARKER);
+            auto pair = static_cast<CLVMObject_Pair const*>(node);
+            todo_stack.push_back(pair->GetRestNode().get());
+            todo_stack.push_back(pair->GetFirstNode().get());
         } else {
-            res = utils::ConnectBuffers(res, AtomToBytes(ToBytes(sexp)));
+            WriteAtom(static_cast<CLVMObject_Atom const*>(node)->GetView(), out);
         }
     }
-    return res;
 }
 
-} // namespace stream
+Bytes32 HashAtom(BytesView atom)
+{
+    uint8_t const prefix { 1 };
+    return crypto_utils::MakeSHA256(BytesView(&prefix, 1), atom);
+}
 
-/**
- * =============================================================================
- * Tree hash
- * =============================================================================
- */
+Bytes32 HashPair(Bytes32 const& first, Bytes32 const& rest)
+{
+    uint8_t const prefix { 2 };
+    return crypto_utils::MakeSHA256(BytesView(&prefix, 1), first, rest);
+}
 
-namespace tree_hash
+uint64_t AtomSerializedSize(BytesView atom)
 {
+    uint64_t size = atom.size();
+    if (size == 0 || (size == 1 && atom[0] <= MAX_SINGLE_BYTE)) {
+        return 1;
+    }
+    if (size < 0x40) {
+        return 1 + size;
+    }
+    if (size < 0x2000) {
+        return 2 + size;
+    }
+    if (size < 0x100000) {
+        return 3 + size;
+    }
+    if (size < 0x8000000) {
+        return 4 + size;
+    }
+    return 5 + size;
+}
 
-class OpStack;
-using Op = std::function<void(ValStack&, OpStack&)>;
+struct Bytes32Hasher {
+    std::size_t operator()(Bytes32 const& hash) const
+    {
+        std::size_t res;
+        memcpy(&res, hash.data(), sizeof(res));
+        return res;
+    }
+};
 
-class OpStack : public Stack<Op>
+/**
+ * Mirrors the stack of values a parser holds while it reads the compressed
+ * format, by the tree hashes of the values. The stack is a list of which the
+ * first item is the value read last. A node equal to the one about to be written
+ * is located by walking down from the root and up from the node through the
+ * pairs that contain it, only the pairs of the current stack are kept
+ */
+class BackrefCache
 {
+public:
+    BackrefCache()
+        : root_(HashAtom(BytesView()))
+    {
+    }
+
+    void Push(Bytes32 const& hash)
+    {
+        Bytes32 new_root = HashPair(hash, root_);
+        stack_.emplace_back(hash, root_);
+        ++count_[hash];
+        ++count_[new_root];
+        parents_[hash].emplace_back(new_root, 0);
+        parents_[root_].emplace_back(new_root, 1);
+        children_.emplace(new_root, std::make_pair(hash, root_));
+        root_ = new_root;
+    }
+
+    /// Replace the 2 values on the top by the pair of them, it is what the parser does when both sides are read
+    void Pop2AndCons()
+    {
+        Bytes32 rest = Pop();
+        Bytes32 first = Pop();
+        ++count_[first];
+        ++count_[rest];
+        Bytes32 pair = HashPair(first, rest);
+        parents_[first].emplace_back(pair, 0);
+        parents_[rest].emplace_back(pair, 1);
+        children_.emplace(pair, std::make_pair(first, rest));
+        Push(pair);
+    }
+
+    /**
+     * Find the shortest path to a node in the stack
+     *
+     * @param hash The tree hash of the node
+     * @param max_bits The path isn't worth writing when it has more steps than this
+     *
+     * @return The steps from the root to the node, 0 takes the first and 1 takes the rest,
+     * nothing is returned when the node is not found
+     */
+    std::optional<std::vector<uint8_t>> FindPath(Bytes32 const& hash, std::size_t max_bits) const
+    {
+        auto count_i = count_.find(hash);
+        if (count_i == std::end(count_) || count_i->second == 0) {
+            return {};
+        }
+        if (hash == root_) {
+            return std::vector<uint8_t>();
+        }
+        // The nodes reached from the root with the steps to them, and the nodes reached from the node searched
+        // with the steps from them in reverse order. The side with less nodes to visit next goes one step further
+        // each time until both sides meet, a node may be held by many pairs so the parents are counted ahead
+        std::unordered_map<Bytes32, std::vector<uint8_t>, Bytes32Hasher> down { { root_, {} } };
+        std::unordered_map<Bytes32, std::vector<uint8_t>, Bytes32Hasher> up { { hash, {} } };
+        std::vector<Bytes32> down_frontier { root_ };
+        std::vector<Bytes32> up_frontier { hash };
+        std::size_t num_bits { 0 };
+        while (num_bits < max_bits && !down_frontier.empty() && !up_frontier.empty()) {
+            std::optional<std::vector<uint8_t>> res;
+            auto meet = [&res](std::vector<uint8_t> const& down_path, std::vector<uint8_t> const& up_path) {
+                if (!res || down_path.size() + up_path.size() < res->size()) {
+                    res = down_path;
+                    res->insert(std::end(*res), up_path.rbegin(), up_path.rend());
+                }
+            };
+            std::size_t num_parents { 0 };
+            for (auto const& node : up_frontier) {
+                auto parents_i = parents_.find(node);
+                if (parents_i != std::end(parents_)) {
+                    num_parents += parents_i->second.size();
+                }
+            }
+            std::vector<Bytes32> next_frontier;
+            if (down_frontier.size() * 2 <= num_parents) {
+                for (auto const& node : down_frontier) {
+                    auto children_i = children_.find(node);
+                    if (children_i == std::end(children_)) {
+                        continue;
+                    }
+                    for (uint8_t step : { 0, 1 }) {
+                        Bytes32 const& child = step == 0 ? children_i->second.first : children_i->second.second;
+                        if (down.find(child) != std::end(down)) {
+                            continue;
+                        }
+                        auto path = down.at(node);
+                        path.push_back(step);
+                        auto up_i = up.find(child);
+                        if (up_i != std::end(up)) {
+                            meet(path, up_i->second);
+                        }
+                        down.emplace(child, std::move(path));
+                        next_frontier.push_back(child);
+                    }
+                }
+                down_frontier = std::move(next_frontier);
+            } else {
+                for (auto const& node : up_frontier) {
+                    auto parents_i = parents_.find(node);
+                    if (parents_i == std::end(parents_)) {
+                        continue;
+                    }
+                    for (auto const& parent : parents_i->second) {
+                        if (up.find(parent.first) != std::end(up)) {
+                            continue;
+                        }
+                        auto path = up.at(node);
+                        path.push_back(parent.second);
+                        auto down_i = down.find(parent.first);
+                        if (down_i != std::end(down)) {
+                            meet(down_i->second, path);
+                        }
+                        up.emplace(parent.first, std::move(path));
+                        next_frontier.push_back(parent.first);
+                    }
+                }
+                up_frontier = std::move(next_frontier);
+            }
+            ++num_bits;
+            if (res) {
+                return res;
+            }
+        }
+        return {};
+    }
+
+private:
+    Bytes32 Pop()
+    {
+        Bytes32 hash, prev_root;
+        std::tie(hash, prev_root) = stack_.back();
+        stack_.pop_back();
+        Release(hash);
+        Release(root_);
+        // The root is gone, the pair of the stack above it is no longer a parent of anything
+        RemoveParent(hash, root_, 0);
+        RemoveParent(prev_root, root_, 1);
+        root_ = prev_root;
+        return hash;
+    }
+
+    void Release(Bytes32 const& hash)
+    {
+        auto count_i = count_.find(hash);
+        if (--count_i->second == 0) {
+            count_.erase(count_i);
+        }
+    }
+
+    void RemoveParent(Bytes32 const& hash, Bytes32 const& parent, uint8_t side)
+    {
+        auto parents_i = parents_.find(hash);
+        auto& parents = parents_i->second;
+        // The entries of the stack are added last, it is found at the end unless it is a pair of the same hash
+        for (auto i = parents.size(); i > 0; --i) {
+            if (parents[i - 1].first == parent && parents[i - 1].second == side) {
+                parents.erase(std::begin(parents) + (i - 1));
+                break;
+            }
+        }
+        if (parents.empty()) {
+            parents_.erase(parents_i);
+        }
+    }
+
+    Bytes32 root_;
+    /// The values with the root of the stack below each of them
+    std::vector<std::pair<Bytes32, Bytes32>> stack_;
+    /// Number of the places a node is held in the stack, a node is reachable when it is in the map
+    std::unordered_map<Bytes32, int, Bytes32Hasher> count_;
+    /// The pairs holding a node, with 0 for the first and 1 for the rest
+    std::unordered_map<Bytes32, std::vector<std::pair<Bytes32, uint8_t>>, Bytes32Hasher> parents_;
+    /// The sides of the pairs, a hash always has the same sides so the entries stay after the pairs are gone
+    std::unordered_map<Bytes32, std::pair<Bytes32, Bytes32>, Bytes32Hasher> children_;
 };
 
-Bytes32 SHA256TreeHash(CLVMObjectPtr sexp, std::vector<Bytes> const& precalculated = std::vector<Bytes>())
+/// Encode the steps of a path to an atom, the lowest bit is the first step and a 1 bit is put after the last step
+Bytes PathToBytes(std::vector<uint8_t> const& path)
 {
-    Op handle_pair = [](ValStack& sexp_stack, OpStack& op_stack) {
-        auto p0 = sexp_stack.Pop();
-        auto p1 = sexp_stack.Pop();
-        Bytes prefix = utils::ByteToBytes('\2');
-        sexp_stack.Push(
-            ToSExp(utils::HashToBytes(crypto_utils::MakeSHA256(utils::ConnectBuffers(prefix, ToBytes(p0), ToBytes(p1))))));
-    };
+    Bytes res(path.size() / 8 + 1);
+    for (std::size_t i = 0; i <= path.size(); ++i) {
+        uint8_t bit = i < path.size() ? path[i] : 1;
+        res[res.size() - 1 - i / 8] |= static_cast<uint8_t>(bit << (i % 8));
+    }
+    return res;
+}
 
-    Op roll = [](ValStack& sexp_stack, OpStack& op_stack) {
-        auto p0 = sexp_stack.Pop();
-        auto p1 = sexp_stack.Pop();
-        sexp_stack.Push(p0);
-        sexp_stack.Push(p1);
+void SExpToStreamWithBackrefs(CLVMObjectPtr const& sexp, Bytes& out)
+{
+    struct NodeInfo {
+        Bytes32 hash;
+        uint64_t serialized_size;
     };
+    // The hashes and sizes of the nodes are calculated ahead, children before their pairs
+    std::unordered_map<CLVMObject const*, NodeInfo> infos;
+    std::vector<std::pair<CLVMObject const*, bool>> todo_stack { { sexp.get(), false } };
+    while (!todo_stack.empty()) {
+        CLVMObject const* node;
+        bool children_done;
+        std::tie(node, children_done) = todo_stack.back();
+        todo_stack.pop_back();
+        if (infos.find(node) != std::end(infos)) {
+            continue;
+        }
+        if (node->GetNodeType() != NodeType::List && node->GetNodeType() != NodeType::Tuple) {
+            BytesView atom = static_cast<CLVMObject_Atom const*>(node)->GetView();
+            infos[node] = { HashAtom(atom), AtomSerializedSize(atom) };
+            continue;
+        }
+        auto pair = static_cast<CLVMObject_Pair const*>(node);
+        if (children_done) {
+            auto const& first = infos[pair->GetFirstNode().get()];
+            auto const& rest = infos[pair->GetRestNode().get()];
+            infos[node] = { HashPair(first.hash, rest.hash), 1 + first.serialized_size + rest.serialized_size };
+            continue;
+        }
+        todo_stack.emplace_back(node, true);
+        todo_stack.emplace_back(pair->GetRestNode().get(), false);
+        todo_stack.emplace_back(pair->GetFirstNode().get(), false);
+    }
 
-    Op handle_sexp = [&handle_sexp, &handle_pair, &roll, &precalculated](ValStack& sexp_stack, OpStack& op_stack) {
-        auto sexp = sexp_stack.Pop();
-        if (IsPair(sexp)) {
-            CLVMObjectPtr p0, p1;
-            std::tie(p0, p1) = Pair(sexp);
-            sexp_stack.Push(p0);
-            sexp_stack.Push(p1);
-            op_stack.Push(handle_pair);
-            op_stack.Push(handle_sexp);
-            op_stack.Push(roll);
-            op_stack.Push(handle_sexp);
+    // Replay what the parser does, a pair is made on the cache whenever both sides of it are written
+    enum class ReadOp : uint8_t { Parse, Cons };
+    std::vector<ReadOp> read_op_stack { ReadOp::Parse };
+    std::vector<CLVMObject const*> write_stack { sexp.get() };
+    BackrefCache cache;
+    while (!write_stack.empty()) {
+        CLVMObject const* node = write_stack.back();
+        write_stack.pop_back();
+        read_op_stack.pop_back();
+        NodeInfo const& info = infos[node];
+        std::optional<std::vector<uint8_t>> path;
+        // The shortest back reference takes 2 bytes, the path has at most (size - 2) * 8 - 1 steps to be shorter
+        if (info.serialized_size > 2) {
+            path = cache.FindPath(info.hash, static_cast<std::size_t>((info.serialized_size - 2) * 8 - 1));
+        }
+        Bytes path_bytes;
+        if (path) {
+            path_bytes = PathToBytes(*path);
+        }
+        if (path && 1 + AtomSerializedSize(path_bytes) < info.serialized_size) {
+            out.push_back(BACK_REFERENCE);
+            WriteAtom(path_bytes, out);
+            cache.Push(info.hash);
+        } else if (node->GetNodeType() == NodeType::List || node->GetNodeType() == NodeType::Tuple) {
+            out.push_back(CONS_BOX_MARKER);
+            auto pair = static_cast<CLVMObject_Pair const*>(node);
+            write_stack.push_back(pair->GetRestNode().get());
+            write_stack.push_back(pair->GetFirstNode().get());
+            read_op_stack.push_back(ReadOp::Cons);
+            read_op_stack.push_back(ReadOp::Parse);
+            read_op_stack.push_back(ReadOp::Parse);
         } else {
-            Bytes atom = ToBytes(sexp);
-            auto i = std::find(std::begin(precalculated), std::end(precalculated), atom);
-            Bytes r;
-            if (i != std::end(precalculated)) {
-                r = atom;
+            WriteAtom(static_cast<CLVMObject_Atom const*>(node)->GetView(), out);
+            cache.Push(info.hash);
+        }
+        while (!read_op_stack.empty() && read_op_stack.back() == ReadOp::Cons) {
+            read_op_stack.pop_back();
+            cache.Pop2AndCons();
+        }
+    }
+}
+
+[[noreturn]] void ThrowAtOffset(char const* what, std::size_t offset)
+{
+    std::stringstream ss;
+    ss << what << " at offset " << offset;
+    throw std::runtime_error(ss.str());
+}
+
+/// Decode the size of an atom from its prefix `b` and the bytes following it, `b` is not a single byte atom
+template <typename Source> std::size_t ReadAtomSize(Source& source, uint8_t b, std::size_t start)
+{
+    int bit_count { 0 };
+    uint8_t bit_mask { 0x80 };
+    while (b & bit_mask) {
+        ++bit_count;
+        b &= 0xff ^ bit_mask;
+        bit_mask >>= 1;
+    }
+    uint64_t size = b;
+    for (int i = 1; i < bit_count; ++i) {
+        size = (size << 8) | source.ReadByte();
+    }
+    if (size >= 0x400000000) {
+        ThrowAtOffset("blob too large", start);
+    }
+    return static_cast<std::size_t>(size);
+}
+
+/**
+ * Parse a serialized program from a source of bytes, the source provides
+ *
+ * `uint8_t ReadByte()` to read the next byte,
+ * `CLVMObjectPtr ReadBlob(std::size_t size, std::size_t start)` to read an atom of `size` bytes,
+ * `std::size_t GetPos()` to tell the number of bytes consumed
+ */
+template <typename Source> class SExpParser
+{
+public:
+    SExpParser(Source& source, ImportOptions const& options)
+        : source_(source)
+        , max_depth_(options.max_depth)
+        , allow_backrefs_(options.allow_backrefs)
+    {
+    }
+
+    CLVMObjectPtr Parse()
+    {
+        enum class ParseOp : uint8_t { ReadSExp, Cons };
+        // The depth of a node is counted by the pairs above it
+        std::vector<std::pair<ParseOp, std::size_t>> op_stack { { ParseOp::ReadSExp, 0 } };
+        while (!op_stack.empty()) {
+            ParseOp op;
+            std::size_t depth;
+            std::tie(op, depth) = op_stack.back();
+            op_stack.pop_back();
+            if (op == ParseOp::Cons) {
+                auto rest = PopVal();
+                auto first = PopVal();
+                val_stack_.push_back(ToSExpPair(std::move(first), std::move(rest)));
+                continue;
+            }
+            std::size_t start = source_.GetPos();
+            uint8_t b = source_.ReadByte();
+            if (b == CONS_BOX_MARKER) {
+                if (max_depth_ != 0 && depth >= max_depth_) {
+                    ThrowAtOffset("program too deep", start);
+                }
+                op_stack.emplace_back(ParseOp::Cons, depth);
+                op_stack.emplace_back(ParseOp::ReadSExp, depth + 1);
+                op_stack.emplace_back(ParseOp::ReadSExp, depth + 1);
+                continue;
+            }
+            if (b == BACK_REFERENCE && allow_backrefs_) {
+                auto path = ReadAtom(source_.ReadByte(), start);
+                val_stack_.push_back(TraverseValStack(ToBytesView(path), start));
+                continue;
+            }
+            val_stack_.push_back(ReadAtom(b, start));
+        }
+        return PopVal();
+    }
+
+private:
+    CLVMObjectPtr ReadAtom(uint8_t b, std::size_t start)
+    {
+        if (b == 0x80) {
+            return MakeNull();
+        }
+        if (b <= MAX_SINGLE_BYTE) {
+            return ToSExpByte(b);
+        }
+        return source_.ReadBlob(ReadAtomSize(source_, b, start), start);
+    }
+
+    CLVMObjectPtr PopVal()
+    {
+        CLVMObjectPtr val = std::move(val_stack_.back());
+        val_stack_.pop_back();
+        return val;
+    }
+
+    /**
+     * Follow a path into the values parsed so far, the stack is seen as a list
+     * whose first item is the last value parsed, the same as `traverse_path` a
+     * bit 0 goes to the first and a bit 1 goes to the rest, from the lowest bit
+     */
+    CLVMObjectPtr TraverseValStack(BytesView path, std::size_t start) const
+    {
+        std::size_t end_byte_cursor { 0 };
+        while (end_byte_cursor < path.size() && path[end_byte_cursor] == 0) {
+            ++end_byte_cursor;
+        }
+        if (end_byte_cursor == path.size()) {
+            return MakeNull();
+        }
+        int end_bitmask = msb_mask(path[end_byte_cursor]);
+        std::size_t byte_cursor = path.size() - 1;
+        int bitmask = 0x01;
+        // Number of items skipped in the stack, the node is located once a first is taken from the stack
+        std::size_t stack_index { 0 };
+        CLVMObjectPtr node;
+        while (byte_cursor > end_byte_cursor || bitmask < end_bitmask) {
+            bool rest = (path[byte_cursor] & bitmask) != 0;
+            if (node) {
+                if (!IsPair(node)) {
+                    ThrowAtOffset("path into atom", start);
+                }
+                auto pair = static_cast<CLVMObject_Pair const*>(node.get());
+                node = rest ? pair->GetRestNode() : pair->GetFirstNode();
+            } else if (stack_index >= val_stack_.size()) {
+                ThrowAtOffset("path into atom", start);
+            } else if (rest) {
+                ++stack_index;
             } else {
-                Bytes prefix = utils::ByteToBytes('\1');
-                r = utils::HashToBytes(crypto_utils::MakeSHA256(utils::ConnectBuffers(prefix, atom)));
+                node = val_stack_[val_stack_.size() - 1 - stack_index];
+            }
+            bitmask <<= 1;
+            if (bitmask == 0x100) {
+                --byte_cursor;
+                bitmask = 0x01;
             }
-            sexp_stack.Push(ToSExp(r));
         }
-    };
+        if (node) {
+            return node;
+        }
+        // The path points to the rest of the stack, make it into a list
+        CLVMObjectPtr list = MakeNull();
+        for (std::size_t i = 0; i + stack_index < val_stack_.size(); ++i) {
+            list = ToSExpPair(val_stack_[i], list);
+        }
+        return list;
+    }
 
-    ValStack sexp_stack;
-    sexp_stack.Push(sexp);
-    OpStack op_stack;
-    op_stack.Push(handle_sexp);
+    Source& source_;
+    std::size_t max_depth_;
+    bool allow_backrefs_;
+    std::vector<CLVMObjectPtr> val_stack_;
+};
 
-    while (!op_stack.IsEmpty()) {
-        auto op = op_stack.Pop();
-        op(sexp_stack, op_stack);
+/// Bytes of a contiguous buffer, long atoms refer to the buffer when it has an owner to keep it alive
+class BufferSource
+{
+public:
+    BufferSource(BytesView bytes, std::size_t max_size, std::shared_ptr<void const> owner = nullptr)
+        : bytes_(bytes)
+        , max_size_(max_size)
+        , owner_(std::move(owner))
+    {
+    }
+
+    uint8_t ReadByte()
+    {
+        CheckSize(pos_ + 1);
+        if (pos_ >= bytes_.size()) {
+            ThrowAtOffset("bad encoding", pos_);
+        }
+        return bytes_[pos_++];
+    }
+
+    CLVMObjectPtr ReadBlob(std::size_t size, std::size_t start)
+    {
+        BytesView blob = ReadView(size, start);
+        if (owner_) {
+            return MakeShared<CLVMObject_Atom>(owner_, blob);
+        }
+        return MakeShared<CLVMObject_Atom>(blob);
+    }
+
+    /// Read `size` bytes, they stay in the buffer
+    BytesView ReadView(std::size_t size, std::size_t start)
+    {
+        CheckSize(pos_ + size);
+        if (size > bytes_.size() - pos_) {
+            ThrowAtOffset("bad encoding", start);
+        }
+        BytesView view(bytes_.data() + pos_, size);
+        pos_ += size;
+        return view;
+    }
+
+    std::size_t GetPos() const { return pos_; }
+
+private:
+    void CheckSize(std::size_t size) const
+    {
+        if (max_size_ != 0 && size > max_size_) {
+            ThrowAtOffset("program too large", max_size_);
+        }
+    }
+
+    BytesView bytes_;
+    std::size_t max_size_;
+    std::shared_ptr<void const> owner_;
+    std::size_t pos_ { 0 };
+};
+
+/**
+ * Bytes pulled from a reader into a fixed size buffer, an atom larger than the
+ * buffer is collected from it chunk by chunk
+ */
+class ReaderSource
+{
+public:
+    /// Read up to `size` bytes into `data`, returns the number of bytes read, 0 means the end of the input
+    using ReadFunc = std::function<std::size_t(uint8_t* data, std::size_t size)>;
+
+    ReaderSource(ReadFunc read, std::size_t buffer_size, std::size_t max_size)
+        : read_(std::move(read))
+        , buffer_(std::max<std::size_t>(buffer_size, 1))
+        , max_size_(max_size)
+    {
+    }
+
+    uint8_t ReadByte()
+    {
+        if (begin_ == end_ && !Fill()) {
+            ThrowAtOffset("bad encoding", GetPos());
+        }
+        CheckSize(GetPos() + 1);
+        return buffer_[begin_++];
+    }
+
+    CLVMObjectPtr ReadBlob(std::size_t size, std::size_t start)
+    {
+        CheckSize(GetPos() + size);
+        if (size <= end_ - begin_) {
+            auto atom = MakeShared<CLVMObject_Atom>(BytesView(buffer_.data() + begin_, size));
+            begin_ += size;
+            return atom;
+        }
+        // The size comes from the input, the atom only grows as the bytes arrive so a bogus size can't exhaust the
+        // memory before the input ends
+        Bytes blob(buffer_.data() + begin_, buffer_.data() + end_);
+        begin_ = end_;
+        while (blob.size() < size) {
+            if (!Fill()) {
+                ThrowAtOffset("bad encoding", start);
+            }
+            std::size_t n = std::min(end_ - begin_, size - blob.size());
+            blob.insert(std::end(blob), buffer_.data() + begin_, buffer_.data() + begin_ + n);
+            begin_ += n;
+        }
+        return MakeShared<CLVMObject_Atom>(std::move(blob));
+    }
+
+    std::size_t GetPos() const { return consumed_ + begin_; }
+
+private:
+    bool Fill()
+    {
+        consumed_ += end_;
+        begin_ = 0;
+        end_ = read_(buffer_.data(), buffer_.size());
+        return end_ != 0;
     }
 
-    assert(!sexp_stack.IsEmpty());
-    auto res = sexp_stack.Pop();
-    assert(sexp_stack.IsEmpty());
-    assert(IsAtom(res));
+    void CheckSize(std::size_t size) const
+    {
+        if (max_size_ != 0 && size > max_size_) {
+            ThrowAtOffset("program too large", max_size_);
+        }
+    }
+
+    ReadFunc read_;
+    Bytes buffer_;
+    std::size_t begin_ { 0 };
+    std::size_t end_ { 0 };
+    /// Number of bytes consumed before the data in the buffer
+    std::size_t consumed_ { 0 };
+    std::size_t max_size_;
+};
+
+/// Walk a serialized program to find where it ends, no node is created
+std::size_t ScanSerializedLength(BytesView bytes, ImportOptions const& options)
+{
+    BufferSource source(bytes, options.max_size);
+    // The depths of the nodes left to read
+    std::vector<std::size_t> depth_stack { 0 };
+    while (!depth_stack.empty()) {
+        std::size_t depth = depth_stack.back();
+        depth_stack.pop_back();
+        std::size_t start = source.GetPos();
+        uint8_t b = source.ReadByte();
+        if (b == CONS_BOX_MARKER) {
+            if (options.max_depth != 0 && depth >= options.max_depth) {
+                ThrowAtOffset("program too deep", start);
+            }
+            depth_stack.push_back(depth + 1);
+            depth_stack.push_back(depth + 1);
+            continue;
+        }
+        if (b == BACK_REFERENCE && options.allow_backrefs) {
+            // Only the encoding of the path is checked, it requires the tree to be followed
+            b = source.ReadByte();
+        }
+        if (b != 0x80 && b > MAX_SINGLE_BYTE) {
+            source.ReadView(ReadAtomSize(source, b, start), start);
+        }
+    }
+    return source.GetPos();
+}
 
-    return utils::BytesToHash(ToBytes(res));
+/// Hash a serialized program while reading it, the hashes of the pending subtrees are kept on a stack
+Bytes32 HashSerializedTree(BytesView bytes)
+{
+    BufferSource source(bytes, 0);
+    enum class HashOp : uint8_t { ReadSExp, Cons };
+    std::vector<HashOp> op_stack { HashOp::ReadSExp };
+    std::vector<Bytes32> hash_stack;
+    while (!op_stack.empty()) {
+        HashOp op = op_stack.back();
+        op_stack.pop_back();
+        if (op == HashOp::Cons) {
+            Bytes32 rest = hash_stack.back();
+            hash_stack.pop_back();
+            hash_stack.back() = HashPair(hash_stack.back(), rest);
+            continue;
+        }
+        std::size_t start = source.GetPos();
+        uint8_t b = source.ReadByte();
+        if (b == CONS_BOX_MARKER) {
+            op_stack.push_back(HashOp::Cons);
+            op_stack.push_back(HashOp::ReadSExp);
+            op_stack.push_back(HashOp::ReadSExp);
+            continue;
+        }
+        if (b == 0x80) {
+            hash_stack.push_back(HashAtom(BytesView()));
+        } else if (b <= MAX_SINGLE_BYTE) {
+            hash_stack.push_back(HashAtom(BytesView(&b, 1)));
+        } else {
+            hash_stack.push_back(HashAtom(source.ReadView(ReadAtomSize(source, b, start), start)));
+        }
+    }
+    return hash_stack.back();
+}
+
+CLVMObjectPtr SExpFromReader(ReaderSource::ReadFunc read, ImportOptions const& options)
+{
+    ReaderSource source(std::move(read), options.buffer_size, options.max_size);
+    return SExpParser<ReaderSource>(source, options).Parse();
+}
+
+} // namespace stream
+
+/**
+ * =============================================================================
+ * Tree hash
+ * =============================================================================
+ */
+
+namespace tree_hash
+{
+
+/**
+ * Calculate the tree hash with a stack of nodes to visit and a stack of the
+ * hashes calculated, a pair is visited twice, the second time its top two
+ * hashes are combined. Without `precalculated` the hash of each pair is kept
+ * by the pair, a shared subtree is hashed only once
+ *
+ * @param sexp The root of the tree
+ * @param precalculated The atoms which are hashes already, they are taken as their own tree hash
+ *
+ * @return The tree hash
+ */
+Bytes32 SHA256TreeHash(CLVMObjectPtr const& sexp, std::vector<Bytes> const& precalculated = std::vector<Bytes>())
+{
+    bool use_cache = precalculated.empty();
+    // The flag tells the children of the pair have been hashed
+    std::vector<std::pair<CLVMObject const*, bool>> node_stack { { sexp.get(), false } };
+    std::vector<Bytes32> hash_stack;
+    while (!node_stack.empty()) {
+        CLVMObject const* node;
+        bool combine;
+        std::tie(node, combine) = node_stack.back();
+        node_stack.pop_back();
+        if (combine) {
+            Bytes32 rest = hash_stack.back();
+            hash_stack.pop_back();
+            hash_stack.back() = stream::HashPair(hash_stack.back(), rest);
+            if (use_cache) {
+                static_cast<CLVMObject_Pair const*>(node)->SetCachedTreeHash(hash_stack.back());
+            }
+            continue;
+        }
+        if (node->GetNodeType() == NodeType::List || node->GetNodeType() == NodeType::Tuple) {
+            auto pair = static_cast<CLVMObject_Pair const*>(node);
+            Bytes32 hash;
+            if (use_cache && pair->GetCachedTreeHash(hash)) {
+                hash_stack.push_back(hash);
+                continue;
+            }
+            node_stack.emplace_back(pair, true);
+            node_stack.emplace_back(pair->GetRestNode().get(), false);
+            node_stack.emplace_back(pair->GetFirstNode().get(), false);
+            continue;
+        }
+        BytesView atom = static_cast<CLVMObject_Atom const*>(node)->GetView();
+        auto i = std::find_if(std::begin(precalculated), std::end(precalculated),
+            [atom](Bytes const& hash) { return BytesView(hash) == atom; });
+        if (i != std::end(precalculated)) {
+            hash_stack.push_back(utils::BytesToHash(*i));
+        } else {
+            hash_stack.push_back(stream::HashAtom(atom));
+        }
+    }
+    assert(hash_stack.size() == 1);
+    return hash_stack.back();
 }
 
 } // namespace tree_hash
@@ -557,10 +1338,74 @@ Bytes32 SHA256TreeHash(CLVMObjectPtr sexp, std::vector<Bytes> const& precalculat
  * =============================================================================
  */
 
-Program Program::ImportFromBytes(Bytes const& bytes)
+std::size_t SerializedLength(BytesView bytes, ImportOptions const& options)
+{
+    return stream::ScanSerializedLength(bytes, options);
+}
+
+Bytes32 TreeHashFromSerialized(BytesView bytes) { return stream::HashSerializedTree(bytes); }
+
+Bytes32 CurryTreeHash(Bytes32 const& mod_hash, std::vector<Bytes32> const& arg_hashes)
+{
+    auto hash_byte = [](uint8_t b) { return stream::HashAtom(BytesView(&b, 1)); };
+    static Bytes32 const quote_hash = hash_byte(1);
+    static Bytes32 const cons_hash = hash_byte(4);
+    static Bytes32 const apply_hash = hash_byte(2);
+    static Bytes32 const null_hash = stream::HashAtom(BytesView());
+    // Same structure as `Program::Curry`, the environment starts from the atom 1
+    Bytes32 env_hash = quote_hash;
+    for (auto i = arg_hashes.rbegin(); i != arg_hashes.rend(); ++i) {
+        Bytes32 quoted_arg_hash = stream::HashPair(quote_hash, *i);
+        env_hash = stream::HashPair(
+            cons_hash, stream::HashPair(quoted_arg_hash, stream::HashPair(env_hash, null_hash)));
+    }
+    Bytes32 quoted_mod_hash = stream::HashPair(quote_hash, mod_hash);
+    return stream::HashPair(apply_hash, stream::HashPair(quoted_mod_hash, stream::HashPair(env_hash, null_hash)));
+}
+
+Program Program::ImportFromBytes(Bytes const& bytes, ImportOptions const& options)
+{
+    Program prog;
+    stream::BufferSource source(bytes, options.max_size);
+    prog.sexp_ = stream::SExpParser<stream::BufferSource>(source, options).Parse();
+    return prog;
+}
+
+Program Program::ImportFromStream(std::istream& in, ImportOptions const& options)
 {
     Program prog;
-    prog.sexp_ = stream::SExpFromStream(stream::StreamReader(bytes));
+    prog.sexp_ = stream::SExpFromReader(
+        [&in](uint8_t* data, std::size_t size) -> std::size_t {
+            in.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size));
+            if (in.bad()) {
+                throw std::runtime_error("failed to read from stream");
+            }
+            return static_cast<std::size_t>(in.gcount());
+        },
+        options);
+    return prog;
+}
+
+Program Program::ImportFromFd(int fd, ImportOptions const& options)
+{
+    Program prog;
+    prog.sexp_ = stream::SExpFromReader(
+        [fd](uint8_t* data, std::size_t size) -> std::size_t {
+            while (true) {
+#ifdef _WIN32
+                int n = _read(fd, data, static_cast<unsigned int>(std::min<std::size_t>(size, INT_MAX)));
+#else
+                ssize_t n = ::read(fd, data, size);
+#endif
+                if (n >= 0) {
+                    return static_cast<std::size_t>(n);
+                }
+                if (errno != EINTR) {
+                    throw std::runtime_error("failed to read from file descriptor");
+                }
+            }
+        },
+        options);
     return prog;
 }
 
@@ -570,6 +1415,15 @@ Program Program::ImportFromHex(std::string hex)
     return ImportFromBytes(prog_bytes);
 }
 
+Program Program::ImportFromMappedFile(std::string file_path, ImportOptions const& options)
+{
+    auto mapped_file = MappedFile::Open(file_path);
+    stream::BufferSource source(mapped_file->GetView(), options.max_size, mapped_file);
+    Program prog;
+    prog.sexp_ = stream::SExpParser<stream::BufferSource>(source, options).Parse();
+    return prog;
+}
+
 Program Program::ImportFromCompiledFile(std::string file_path)
 {
     std::string hex = utils::LoadHexFromFile(file_path);
@@ -590,7 +1444,21 @@ Program::Program(CLVMObjectPtr sexp)
 
 Bytes32 Program::GetTreeHash() const { return tree_hash::SHA256TreeHash(sexp_); }
 
-Bytes Program::Serialize() const { return stream::SExpToStream(sexp_); }
+Bytes Program::Serialize() const
+{
+    Bytes res;
+    Serialize(res);
+    return res;
+}
+
+void Program::Serialize(Bytes& out) const { stream::SExpToStream(sexp_, out); }
+
+Bytes Program::SerializeWithBackrefs() const
+{
+    Bytes res;
+    stream::SExpToStreamWithBackrefs(sexp_, res);
+    return res;
+}
 
 uint8_t msb_mask(uint8_t byte)
 {
@@ -603,13 +1471,14 @@ uint8_t msb_mask(uint8_t byte)
 namespace run
 {
 
-class OpStack;
-using Op = std::function<Cost(OpStack&, ValStack&)>;
+enum class Op : uint8_t { Swap, Cons, Eval, Apply };
 
 class OpStack : public Stack<Op>
 {
 };
 
+std::size_t const INITIAL_STACK_SIZE = 256;
+
 void debug_atom(std::string prefix, OperatorLookup const& operator_lookup, uint8_t atom)
 {
     try {
@@ -620,7 +1489,7 @@ void debug_atom(std::string prefix, OperatorLookup const& operator_lookup, uint8
     }
 }
 
-std::tuple<Cost, CLVMObjectPtr> traverse_path(CLVMObjectPtr sexp, CLVMObjectPtr env)
+static std::tuple<Cost, CLVMObjectPtr> traverse_path(CLVMObjectPtr sexp, CLVMObjectPtr env)
 {
     Cost cost { PATH_LOOKUP_BASE_COST };
     cost += PATH_LOOKUP_COST_PER_LEG;
@@ -628,9 +1497,9 @@ std::tuple<Cost, CLVMObjectPtr> traverse_path(CLVMObjectPtr sexp, CLVMObjectPtr
         return std::make_tuple(cost, MakeNull());
     }
 
-    Bytes b = ToBytes(sexp);
+    BytesView b = ToBytesView(sexp);
 
-    int end_byte_cursor { 0 };
+    std::size_t end_byte_cursor { 0 };
     while (end_byte_cursor < b.size() && b[end_byte_cursor] == 0) {
         ++end_byte_cursor;
     }
@@ -642,7 +1511,7 @@ std::tuple<Cost, CLVMObjectPtr> traverse_path(CLVMObjectPtr sexp, CLVMObjectPtr
 
     int end_bitmask = msb_mask(b[end_byte_cursor]);
 
-    int byte_cursor = static_cast<int>(b.size()) - 1;
+    std::size_t byte_cursor = b.size() - 1;
     int bitmask = 0x01;
     while (byte_cursor > end_byte_cursor || bitmask < end_bitmask) {
         if (!IsPair(env)) {
@@ -664,116 +1533,157 @@ std::tuple<Cost, CLVMObjectPtr> traverse_path(CLVMObjectPtr sexp, CLVMObjectPtr
     return std::make_tuple(cost, env);
 };
 
-std::tuple<Cost, CLVMObjectPtr> run_program(CLVMObjectPtr program, CLVMObjectPtr args,
-    OperatorLookup const& operator_lookup = OperatorLookup(), Cost max_cost = 0)
+static Cost swap_op(ValStack& val_stack)
 {
+    auto v2 = val_stack.Pop();
+    auto v1 = val_stack.Pop();
+    val_stack.Push(std::move(v2));
+    val_stack.Push(std::move(v1));
+    return 0;
+}
 
-    Op swap_op, cons_op, eval_op, apply_op;
-
-    swap_op = [&apply_op](OpStack& op_stack, ValStack& val_stack) -> Cost {
-        auto v2 = val_stack.Pop();
-        auto v1 = val_stack.Pop();
-        val_stack.Push(v2);
-        val_stack.Push(v1);
-        return 0;
-    };
+static Cost cons_op(ValStack& val_stack)
+{
+    auto v2 = val_stack.Pop();
+    auto v1 = val_stack.Pop();
+    val_stack.Push(ToSExpPair(v2, v1));
+    return 0;
+}
 
-    cons_op = [](OpStack& op_stack, ValStack& val_stack) -> Cost {
-        auto v2 = val_stack.Pop();
-        auto v1 = val_stack.Pop();
-        val_stack.Push(ToSExpPair(v2, v1));
-        return 0;
-    };
+static Cost eval_op(OpStack& op_stack, ValStack& val_stack, OperatorLookup const& operator_lookup)
+{
+    auto pair = val_stack.Pop();
+    CLVMObjectPtr sexp, args;
+    std::tie(sexp, args) = Pair(pair);
+    if (!IsPair(sexp)) {
+        Cost cost;
+        CLVMObjectPtr r;
+        std::tie(cost, r) = traverse_path(sexp, args);
+        val_stack.Push(r);
+        return cost;
+    }
 
-    eval_op
-        = [&operator_lookup, &apply_op, &cons_op, &eval_op, &swap_op](OpStack& op_stack, ValStack& val_stack) -> Cost {
-        auto pair = val_stack.Pop();
-        CLVMObjectPtr sexp, args;
-        std::tie(sexp, args) = Pair(pair);
-        if (!IsPair(sexp)) {
-            Cost cost;
-            CLVMObjectPtr r;
-            std::tie(cost, r) = traverse_path(sexp, args);
-            val_stack.Push(r);
-            return cost;
-        }
-
-        CLVMObjectPtr opt, sexp_rest;
-        std::tie(opt, sexp_rest) = Pair(sexp);
-        if (IsPair(opt)) {
-            CLVMObjectPtr new_opt, must_be_nil;
-            std::tie(new_opt, must_be_nil) = Pair(opt);
-            if (IsPair(new_opt) || !IsNull(must_be_nil)) {
-                throw std::runtime_error("syntax X must be lone atom");
-            }
-            auto new_operand_list = sexp_rest;
-            val_stack.Push(new_opt);
-            val_stack.Push(new_operand_list);
-            op_stack.Push(apply_op);
-            return APPLY_COST;
+    CLVMObjectPtr opt, sexp_rest;
+    std::tie(opt, sexp_rest) = Pair(sexp);
+    if (IsPair(opt)) {
+        CLVMObjectPtr new_opt, must_be_nil;
+        std::tie(new_opt, must_be_nil) = Pair(opt);
+        if (IsPair(new_opt) || !IsNull(must_be_nil)) {
+            throw std::runtime_error("syntax X must be lone atom");
         }
+        auto new_operand_list = sexp_rest;
+        val_stack.Push(new_opt);
+        val_stack.Push(new_operand_list);
+        op_stack.Push(Op::Apply);
+        return APPLY_COST;
+    }
 
-        Bytes op = ToBytes(opt);
-        auto operand_list = sexp_rest;
-        if (op == operator_lookup.QUOTE_ATOM) {
-            val_stack.Push(operand_list);
-            return QUOTE_COST;
-        }
+    BytesView op = ToBytesView(opt);
+    auto operand_list = sexp_rest;
+    if (op == operator_lookup.QUOTE_ATOM) {
+        val_stack.Push(operand_list);
+        return QUOTE_COST;
+    }
 
-        op_stack.Push(apply_op);
-        val_stack.Push(opt);
-        while (!IsNull(operand_list)) {
-            CLVMObjectPtr _, r;
-            std::tie(_, r) = Pair(operand_list);
-            val_stack.Push(ToSExpPair(_, args));
-            op_stack.Push(cons_op);
-            op_stack.Push(eval_op);
-            op_stack.Push(swap_op);
-            operand_list = r;
-        }
+    op_stack.Push(Op::Apply);
+    val_stack.Push(opt);
+    while (!IsNull(operand_list)) {
+        CLVMObjectPtr _, r;
+        std::tie(_, r) = Pair(operand_list);
+        val_stack.Push(ToSExpPair(_, args));
+        op_stack.Push(Op::Cons);
+        op_stack.Push(Op::Eval);
+        op_stack.Push(Op::Swap);
+        operand_list = r;
+    }
 
-        val_stack.Push(MakeNull());
-        return 1;
-    };
+    val_stack.Push(MakeNull());
+    return 1;
+}
 
-    apply_op = [&operator_lookup, &eval_op](OpStack& op_stack, ValStack& val_stack) -> Cost {
-        auto operand_list = val_stack.Pop();
-        auto opt = val_stack.Pop();
-        if (IsPair(opt)) {
-            throw std::runtime_error("internal error");
-        }
+static Cost apply_op(OpStack& op_stack, ValStack& val_stack, OperatorLookup const& operator_lookup, bool strict)
+{
+    auto operand_list = val_stack.Pop();
+    auto opt = val_stack.Pop();
+    if (IsPair(opt)) {
+        throw std::runtime_error("internal error");
+    }
 
-        Bytes op = ToBytes(opt);
-        if (op == operator_lookup.APPLY_ATOM) {
-            if (ListLen(operand_list) != 2) {
-                throw std::runtime_error("apply requires exactly 2 parameters");
-            }
-            CLVMObjectPtr new_program, rest;
-            std::tie(new_program, rest) = Pair(operand_list);
-            auto new_args = First(rest);
-            val_stack.Push(ToSExpPair(new_program, new_args));
-            op_stack.Push(eval_op);
-            return APPLY_COST;
+    BytesView op = ToBytesView(opt);
+    if (op == operator_lookup.APPLY_ATOM) {
+        if (ListLen(operand_list) != 2) {
+            throw std::runtime_error("apply requires exactly 2 parameters");
         }
+        CLVMObjectPtr new_program, rest;
+        std::tie(new_program, rest) = Pair(operand_list);
+        auto new_args = First(rest);
+        val_stack.Push(ToSExpPair(new_program, new_args));
+        op_stack.Push(Op::Eval);
+        return APPLY_COST;
+    }
 
-        Cost additional_cost;
-        CLVMObjectPtr r;
-        std::tie(additional_cost, r) = operator_lookup(op, operand_list);
-        val_stack.Push(r);
-        return additional_cost;
-    };
+    Cost additional_cost;
+    CLVMObjectPtr r;
+    std::tie(additional_cost, r) = operator_lookup(op, operand_list, strict);
+    val_stack.Push(r);
+    return additional_cost;
+}
+
+static std::tuple<Cost, CLVMObjectPtr> run_program(
+    CLVMObjectPtr program, CLVMObjectPtr args, RunOptions const& options = RunOptions())
+{
+    OperatorLookup const& operator_lookup
+        = options.operator_lookup ? *options.operator_lookup : OperatorLookup::GetInstance();
+
+    // All nodes created by the run come from one arena, the memory of a dropped node is reused by the next one and the
+    // arena is freed when the last of the nodes returned by the run is gone
+    AllocatorPtr allocator = Allocator::Create();
+    AllocatorScope allocator_scope(allocator.get());
 
     OpStack op_stack;
-    op_stack.Push(eval_op);
+    op_stack.Reserve(INITIAL_STACK_SIZE);
+    op_stack.Push(Op::Eval);
 
     ValStack val_stack;
+    val_stack.Reserve(INITIAL_STACK_SIZE);
     val_stack.Push(ToSExpPair(program, args));
     Cost cost { 0 };
+    uint64_t num_steps { 0 };
+
+    // The statistics are reported on every exit, including the exceptions raised by the cost limit and the operators
+    struct StatsReporter {
+        RunStats* stats;
+        Cost const& cost;
+        uint64_t const& num_steps;
+        Allocator const& allocator;
+
+        ~StatsReporter()
+        {
+            if (stats) {
+                stats->cost = cost;
+                stats->num_steps = num_steps;
+                stats->num_allocated_bytes = allocator.GetUsedBytes();
+            }
+        }
+    } reporter { options.stats, cost, num_steps, *allocator };
 
     while (!op_stack.IsEmpty()) {
-        auto f = op_stack.Pop();
-        cost += f(op_stack, val_stack);
-        if (max_cost && cost > max_cost) {
+        ++num_steps;
+        switch (op_stack.Pop()) {
+        case Op::Swap:
+            cost += swap_op(val_stack);
+            break;
+        case Op::Cons:
+            cost += cons_op(val_stack);
+            break;
+        case Op::Eval:
+            cost += eval_op(op_stack, val_stack, operator_lookup);
+            break;
+        case Op::Apply:
+            cost += apply_op(op_stack, val_stack, operator_lookup, options.strict);
+            break;
+        }
+        if (options.max_cost && cost > options.max_cost) {
             throw std::runtime_error("cost exceeded");
         }
     }
@@ -785,20 +1695,88 @@ std::tuple<Cost, CLVMObjectPtr> run_program(CLVMObjectPtr program, CLVMObjectPtr
 
 std::tuple<Cost, CLVMObjectPtr> Program::Run(CLVMObjectPtr args) const { return run::run_program(sexp_, args); }
 
-std::string CURRY_OBJ_CODE = "(a (q #a 4 (c 2 (c 5 (c 7 0)))) (c (q (c (q "
-                             ". 2) (c (c (q . 1) 5) (c (a 6 "
-                             "(c 2 (c 11 (q 1)))) 0))) #a (i 5 (q 4 (q . "
-                             "4) (c (c (q . 1) 9) (c (a 6 (c "
-                             "2 (c 13 (c 11 0)))) 0))) (q . 11)) 1) 1))";
+std::tuple<Cost, CLVMObjectPtr> Program::Run(CLVMObjectPtr args, RunOptions const& options) const
+{
+    return run::run_program(sexp_, args, options);
+}
+
+Program Program::Curry(CLVMObjectPtr args) const { return Curry(std::vector<CLVMObjectPtr> { std::move(args) }); }
 
-Program Program::Curry(CLVMObjectPtr args)
+Program Program::Curry(std::vector<CLVMObjectPtr> const& args) const
 {
-    auto curry_program = Assemble(CURRY_OBJ_CODE);
-    auto bind_args = ToSExpPair(sexp_, ToSExpList(args));
-    Cost cost;
-    CLVMObjectPtr sexp;
-    std::tie(cost, sexp) = run::run_program(curry_program, bind_args);
-    return Program(sexp);
+    auto quote = ToSExpByte(1);
+    // The arguments are consed onto the environment, the innermost one is the last argument
+    CLVMObjectPtr env = quote;
+    for (auto i = args.rbegin(); i != args.rend(); ++i) {
+        env = ToSExpPair(ToSExpByte(4), ToSExpPair(ToSExpPair(quote, *i), ToSExpPair(env, MakeNull())));
+    }
+    return Program(ToSExpPair(ToSExpByte(2), ToSExpPair(ToSExpPair(quote, sexp_), ToSExpPair(env, MakeNull()))));
+}
+
+namespace curry
+{
+
+/// Match a list of exactly `N` items, the items are written to `items`
+template <std::size_t N> bool MatchList(CLVMObject const* node, std::array<CLVMObject const*, N>& items)
+{
+    for (std::size_t i = 0; i < N; ++i) {
+        if (node->GetNodeType() != NodeType::List && node->GetNodeType() != NodeType::Tuple) {
+            return false;
+        }
+        auto pair = static_cast<CLVMObject_Pair const*>(node);
+        items[i] = pair->GetFirstNode().get();
+        node = pair->GetRestNode().get();
+    }
+    return node->GetNodeType() != NodeType::List && node->GetNodeType() != NodeType::Tuple
+        && static_cast<CLVMObject_Atom const*>(node)->GetView().empty();
+}
+
+bool IsAtomByte(CLVMObject const* node, uint8_t b)
+{
+    if (node->GetNodeType() == NodeType::List || node->GetNodeType() == NodeType::Tuple) {
+        return false;
+    }
+    BytesView atom = static_cast<CLVMObject_Atom const*>(node)->GetView();
+    return atom.size() == 1 && atom[0] == b;
+}
+
+/// Match `(q . value)`, the value is written to `value`
+bool MatchQuoted(CLVMObject const* node, CLVMObjectPtr& value)
+{
+    if (node->GetNodeType() != NodeType::List && node->GetNodeType() != NodeType::Tuple) {
+        return false;
+    }
+    auto pair = static_cast<CLVMObject_Pair const*>(node);
+    if (!IsAtomByte(pair->GetFirstNode().get(), 1)) {
+        return false;
+    }
+    value = pair->GetRestNode();
+    return true;
+}
+
+} // namespace curry
+
+std::optional<std::tuple<Program, std::vector<CLVMObjectPtr>>> Program::Uncurry() const
+{
+    // (a (q . mod) env)
+    std::array<CLVMObject const*, 3> items;
+    CLVMObjectPtr mod;
+    if (!curry::MatchList(sexp_.get(), items) || !curry::IsAtomByte(items[0], 2)
+        || !curry::MatchQuoted(items[1], mod)) {
+        return std::nullopt;
+    }
+    // env is (c (q . arg) env) for each argument and it ends with 1
+    std::vector<CLVMObjectPtr> args;
+    CLVMObject const* env = items[2];
+    while (!curry::IsAtomByte(env, 1)) {
+        CLVMObjectPtr arg;
+        if (!curry::MatchList(env, items) || !curry::IsAtomByte(items[0], 4) || !curry::MatchQuoted(items[1], arg)) {
+            return std::nullopt;
+        }
+        args.push_back(std::move(arg));
+        env = items[2];
+    }
+    return std::make_tuple(Program(mod), std::move(args));
 }
 
 } // namespace chia
@@ -1,8 +1,11 @@
 #include "clvm/utils.h"
 
 #include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <cctype>
 
 namespace chia
@@ -222,5 +225,60 @@ std::string ToLower(std::string str)
     return res;
 }
 
+void ParallelFor(std::size_t count, std::function<void(std::size_t index)> const& f, std::size_t min_count_per_thread)
+{
+    min_count_per_thread = std::max<std::size_t>(min_count_per_thread, 1);
+    std::size_t max_threads = (count + min_count_per_thread - 1) / min_count_per_thread;
+    std::size_t num_threads = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u), max_threads);
+    std::atomic<std::size_t> next_index { 0 };
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        std::size_t index;
+        while ((index = next_index.fetch_add(1)) < count) {
+            try {
+                f(index);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                // Stop handing out the rest of the indexes
+                next_index = count;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    // A joinable thread must not be destroyed, the threads started are joined even when starting the next one fails
+    struct ThreadsJoiner {
+        std::vector<std::thread>& threads;
+
+        ~ThreadsJoiner()
+        {
+            for (auto& thread : threads) {
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
+        }
+    } joiner { threads };
+    try {
+        threads.reserve(num_threads);
+        for (std::size_t i = 1; i < num_threads; ++i) {
+            threads.emplace_back(worker);
+        }
+    } catch (...) {
+        next_index = count;
+        throw;
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
 } // namespace utils
 } // namespace chia
@@ -1,9 +1,16 @@
+#include <cstdio>
+
 #include <fstream>
+#include <limits>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include "gtest/gtest.h"
 
+#include "clvm/allocator.h"
 #include "clvm/assemble.h"
+#include "clvm/costs.h"
 #include "clvm/int.h"
 #include "clvm/operator_lookup.h"
 #include "clvm/sexp_prog.h"
@@ -52,6 +59,28 @@ TEST(Utilities, Strip)
     EXPECT_EQ(chia::bech32::Strip(""), "");
 }
 
+TEST(Utilities, ParallelFor)
+{
+    std::vector<int> results(1000, 0);
+    chia::utils::ParallelFor(results.size(), [&results](std::size_t i) { results[i] = static_cast<int>(i) * 2; });
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        EXPECT_EQ(results[i], static_cast<int>(i) * 2);
+    }
+    EXPECT_THROW(chia::utils::ParallelFor(100,
+                     [](std::size_t i) {
+                         if (i == 50) {
+                             throw std::runtime_error("failed");
+                         }
+                     }),
+        std::runtime_error);
+    chia::utils::ParallelFor(0, [](std::size_t) { FAIL(); });
+
+    // Too few indexes for a second thread
+    std::thread::id caller = std::this_thread::get_id();
+    chia::utils::ParallelFor(
+        10, [caller](std::size_t) { EXPECT_EQ(std::this_thread::get_id(), caller); }, 100);
+}
+
 std::string const s0 = "ff1dff02ffff1effff0bff02ff05808080";
 std::string const s0_treehash = "624c5d5704d0decadfc0503e71bbffb6cdfe45025bce7cf3e6864d1eafe8f65e";
 
@@ -90,6 +119,38 @@ TEST(CLVM_BigInt, Initial100FromBytes)
     EXPECT_EQ(i.ToInt(), 100);
 }
 
+TEST(CLVM_BigInt, ToBytes)
+{
+    EXPECT_TRUE(chia::Int(0).ToBytes().empty());
+    EXPECT_EQ(chia::Int(0).NumBytes(), 0);
+    EXPECT_EQ(chia::Int(256).ToBytes(), chia::utils::BytesFromHex("0100"));
+    EXPECT_EQ(chia::Int(1000).ToBytes(), chia::utils::BytesFromHex("03e8"));
+    bool neg;
+    EXPECT_EQ(chia::Int(-4096).ToBytes(&neg), chia::utils::BytesFromHex("1000"));
+    EXPECT_TRUE(neg);
+    auto big_bytes = chia::utils::BytesFromHex("0123456789abcdef0123456789abcdef");
+    chia::Int big(big_bytes);
+    EXPECT_EQ(big.ToBytes(), big_bytes);
+    EXPECT_EQ(big.NumBytes(), 16);
+    EXPECT_EQ(big, chia::Int("0x123456789abcdef0123456789abcdef", 0));
+}
+
+TEST(CLVM_BigInt, SignedBytes)
+{
+    std::vector<std::pair<long, std::string>> cases { { 0, "" }, { 1, "01" }, { -1, "ff" }, { 127, "7f" },
+        { 128, "0080" }, { -128, "80" }, { -129, "ff7f" }, { 255, "00ff" }, { -0x8000, "8000" } };
+    for (auto const& c : cases) {
+        EXPECT_EQ(chia::utils::BytesToHex(chia::Int(c.first).ToSignedBytes()), c.second);
+        EXPECT_EQ(chia::Int::FromSignedBytes(chia::utils::BytesFromHex(c.second)), chia::Int(c.first));
+    }
+    for (std::string str : { "0x7fffffffffffffffff", "-0x8000000000000000", "-0x8000000000000001",
+             "0x8000000000000000", "-0x123456789abcdef0123456789" }) {
+        chia::Int i(str, 0);
+        EXPECT_EQ(chia::Int::FromSignedBytes(i.ToSignedBytes()), i);
+    }
+    EXPECT_EQ(chia::utils::BytesToHex(chia::Int("-0x8000000000000001", 0).ToSignedBytes()), "ff7fffffffffffffff");
+}
+
 TEST(CLVM_BigInt, Add)
 {
     uint64_t a = 0x12345678;
@@ -112,6 +173,22 @@ TEST(CLVM_BigInt, Sub)
     EXPECT_EQ((aa - bb).ToInt(), a - b);
 }
 
+TEST(CLVM_BigInt, Overflow)
+{
+    chia::Int max(std::numeric_limits<long>::max());
+    chia::Int big("9223372036854775808", 10);
+    if (sizeof(long) == 8) {
+        EXPECT_EQ(max + chia::Int(1), big);
+        EXPECT_EQ(big - chia::Int(1), max);
+    }
+    EXPECT_EQ(big * big, chia::Int("85070591730234615865843651857942052864", 10));
+    EXPECT_EQ((big * big) / big, big);
+    EXPECT_EQ(chia::Int(1) << 100, chia::Int("1267650600228229401496703205376", 10));
+    EXPECT_EQ((chia::Int(1) << 100) >> 100, chia::Int(1));
+    EXPECT_EQ(chia::Int(-5) >> 1, chia::Int(-3));
+    EXPECT_LT(chia::Int(-1), big);
+}
+
 TEST(CLVM_SExp, List)
 {
     auto sexp_list = chia::ToSExpList(10, 20, 30, 40);
@@ -148,6 +225,385 @@ TEST(CLVM_MsbMask, MsbMask)
     EXPECT_EQ(chia::msb_mask(0x0f), 0x08);
 }
 
+TEST(CLVM, AtomView)
+{
+    auto atom = chia::ToSExp(chia::utils::BytesFromHex("deadbeef"));
+    chia::BytesView view = chia::ToBytesView(atom);
+    EXPECT_EQ(view.data(), chia::ToBytesView(atom).data());
+    EXPECT_EQ(view.ToBytes(), chia::utils::BytesFromHex("deadbeef"));
+    EXPECT_TRUE(view == chia::ToBytesView(chia::ToSExp(chia::utils::BytesFromHex("deadbeef"))));
+    EXPECT_FALSE(view == chia::ToBytesView(chia::ToSExp(chia::utils::BytesFromHex("dead"))));
+    EXPECT_TRUE(chia::ToBytesView(chia::MakeNull()).empty());
+    EXPECT_THROW(chia::ToBytesView(chia::ToSExpPair(atom, atom)), std::runtime_error);
+}
+
+TEST(CLVM, AtomStorage)
+{
+    chia::Bytes short_bytes(chia::AtomStorage::INLINE_SIZE, 0x5a);
+    chia::AtomStorage short_atom(short_bytes);
+    EXPECT_TRUE(short_atom.IsInline());
+    EXPECT_EQ(short_atom.GetView().ToBytes(), short_bytes);
+
+    chia::Bytes long_bytes(chia::AtomStorage::INLINE_SIZE + 1, 0xa5);
+    chia::AtomStorage long_atom(long_bytes);
+    EXPECT_FALSE(long_atom.IsInline());
+    EXPECT_EQ(long_atom.GetView().ToBytes(), long_bytes);
+
+    chia::AtomStorage copied = short_atom;
+    EXPECT_EQ(copied.GetView().ToBytes(), short_bytes);
+    EXPECT_NE(copied.GetView().data(), short_atom.GetView().data());
+
+    EXPECT_EQ(chia::ToBytes(chia::ToSExp(long_bytes)), long_bytes);
+}
+
+TEST(CLVM, InternedAtoms)
+{
+    EXPECT_EQ(chia::MakeNull(), chia::MakeNull());
+    EXPECT_EQ(chia::ToFalse(), chia::MakeNull());
+    EXPECT_EQ(chia::ToTrue(), chia::ToTrue());
+    EXPECT_EQ(chia::ToSExp(200), chia::ToSExp(chia::Int(200)));
+    EXPECT_EQ(chia::ToSExp(-1), chia::ToSExp(chia::Int(-1)));
+    EXPECT_NE(chia::ToSExp(1000), chia::ToSExp(1000));
+    EXPECT_EQ(chia::ToSExp(0)->GetNodeType(), chia::NodeType::Atom_Int);
+    EXPECT_EQ(chia::ToSExpByte(0x10), chia::ToSExpByte(0x10));
+    EXPECT_EQ(chia::ToBytes(chia::ToSExpByte(0x10)), chia::utils::BytesFromHex("10"));
+
+    // Shared atoms never come from an arena
+    chia::AllocatorPtr arena = chia::Allocator::Create();
+    {
+        chia::AllocatorScope scope(arena.get());
+        chia::ToSExp(5);
+        chia::MakeNull();
+    }
+    EXPECT_EQ(arena->GetUsedBytes(), 0);
+}
+
+TEST(CLVM, Serialize)
+{
+    chia::Program prog(chia::Assemble("(a (q . 1) (c 0x1234 ()))"));
+    EXPECT_EQ(chia::utils::BytesToHex(prog.Serialize()), "ff02ffff0101ffff04ff821234ff808080");
+
+    for (std::size_t size : { 0x3f, 0x40, 0x1fff, 0x2000, 0xfffff, 0x100000 }) {
+        chia::Bytes blob(size, 0xcd);
+        chia::Bytes serialized = chia::Program(chia::ToSExp(blob)).Serialize();
+        EXPECT_EQ(chia::ToBytes(chia::Program::ImportFromBytes(serialized).GetSExp()), blob);
+    }
+    EXPECT_EQ(chia::utils::BytesToHex(chia::utils::SubBytes(
+                  chia::Program(chia::ToSExp(chia::Bytes(0x1234, 0))).Serialize(), 0, 2)),
+        "d234");
+
+    // Serializations can be appended to the same buffer
+    chia::Bytes out;
+    prog.Serialize(out);
+    prog.Serialize(out);
+    EXPECT_EQ(chia::utils::BytesToHex(out), "ff02ffff0101ffff04ff821234ff808080ff02ffff0101ffff04ff821234ff808080");
+}
+
+std::string deserialize_error(std::string hex)
+{
+    try {
+        chia::Program::ImportFromHex(hex);
+    } catch (std::runtime_error const& e) {
+        return e.what();
+    }
+    return "";
+}
+
+TEST(CLVM, Deserialize)
+{
+    auto prog = chia::Program::ImportFromHex("ff02ffff0101ffff04ff821234ff808080");
+    EXPECT_EQ(chia::utils::BytesToHex(prog.Serialize()), "ff02ffff0101ffff04ff821234ff808080");
+    EXPECT_EQ(deserialize_error(""), "bad encoding at offset 0");
+    EXPECT_EQ(deserialize_error("ff01"), "bad encoding at offset 2");
+    EXPECT_EQ(deserialize_error("ff018401"), "bad encoding at offset 2");
+    EXPECT_EQ(deserialize_error("ff01c0"), "bad encoding at offset 3");
+    EXPECT_EQ(deserialize_error("fc0400000000"), "blob too large at offset 0");
+}
+
+TEST(CLVM, ImportFromStream)
+{
+    auto list = chia::ToSExpList(chia::Bytes(100, 0xab), 1, 1000, chia::Bytes(5, 0x01));
+    chia::Bytes bytes = chia::Program(list).Serialize();
+    chia::ImportOptions options;
+    for (std::size_t buffer_size : { 1, 3, 64, 4096 }) {
+        options.buffer_size = buffer_size;
+        std::stringstream ss(std::string(std::begin(bytes), std::end(bytes)));
+        auto prog = chia::Program::ImportFromStream(ss, options);
+        EXPECT_EQ(prog.Serialize(), bytes);
+    }
+
+    options = chia::ImportOptions();
+    options.max_size = bytes.size() - 1;
+    std::stringstream too_large(std::string(std::begin(bytes), std::end(bytes)));
+    EXPECT_THROW(chia::Program::ImportFromStream(too_large, options), std::runtime_error);
+
+    options = chia::ImportOptions();
+    options.max_depth = 3;
+    std::stringstream too_deep(std::string(std::begin(bytes), std::end(bytes)));
+    EXPECT_THROW(chia::Program::ImportFromStream(too_deep, options), std::runtime_error);
+    options.max_depth = 4;
+    std::stringstream deep_enough(std::string(std::begin(bytes), std::end(bytes)));
+    EXPECT_EQ(chia::Program::ImportFromStream(deep_enough, options).Serialize(), bytes);
+
+    std::stringstream truncated(std::string(std::begin(bytes), std::end(bytes) - 1));
+    EXPECT_THROW(chia::Program::ImportFromStream(truncated), std::runtime_error);
+
+    // The size of an atom is not trusted before its bytes arrive
+    chia::Bytes huge_atom = chia::utils::BytesFromHex("fb03ffffff");
+    std::stringstream huge_default(std::string(std::begin(huge_atom), std::end(huge_atom)));
+    EXPECT_THROW(chia::Program::ImportFromStream(huge_default), std::runtime_error);
+    options = chia::ImportOptions();
+    options.max_size = 0;
+    std::stringstream huge_unlimited(std::string(std::begin(huge_atom), std::end(huge_atom)));
+    EXPECT_THROW(chia::Program::ImportFromStream(huge_unlimited, options), std::runtime_error);
+}
+
+TEST(CLVM, ImportFromMappedFile)
+{
+    chia::Bytes long_atom(200, 0x3c);
+    auto list = chia::ToSExpList(long_atom, 7, chia::utils::BytesFromHex("cafe"));
+    chia::Bytes bytes = chia::Program(list).Serialize();
+    std::string file_path = "test_clvm_mapped.bin";
+    {
+        std::ofstream out(file_path, std::ios::binary);
+        out.write(reinterpret_cast<char const*>(bytes.data()), bytes.size());
+    }
+    chia::CLVMObjectPtr first;
+    {
+        auto prog = chia::Program::ImportFromMappedFile(file_path);
+        EXPECT_EQ(prog.Serialize(), bytes);
+        first = chia::First(prog.GetSExp());
+    }
+    // The long atom keeps the mapping alive after the program is gone
+    EXPECT_EQ(chia::ToBytes(first), long_atom);
+    std::remove(file_path.c_str());
+    EXPECT_THROW(chia::Program::ImportFromMappedFile(file_path), std::runtime_error);
+}
+
+TEST(CLVM, Backrefs)
+{
+    auto one_two = chia::ToSExpPair(chia::ToSExp(1), chia::ToSExp(2));
+    chia::Program prog(chia::ToSExpPair(one_two, one_two));
+    EXPECT_EQ(chia::utils::BytesToHex(prog.SerializeWithBackrefs()), "ffff0102fe02");
+
+    chia::ImportOptions options;
+    options.allow_backrefs = true;
+    EXPECT_THROW(chia::Program::ImportFromBytes(chia::utils::BytesFromHex("ffff0102fe02")), std::runtime_error);
+    auto imported = chia::Program::ImportFromBytes(chia::utils::BytesFromHex("ffff0102fe02"), options);
+    EXPECT_EQ(imported.Serialize(), prog.Serialize());
+
+    // The same puzzle revealed many times is written once
+    auto puzzle = chia::Assemble("(a (q 2 (i 5 (q 4 (c 2 (c 5 ())) (q . 1)) ()) 1) (c (q . 0x0102030405) 1))");
+    chia::ListBuilder builder;
+    for (int i = 0; i < 20; ++i) {
+        builder.Add(chia::ToSExpList(puzzle, i));
+    }
+    chia::Program spends(builder.GetRoot());
+    chia::Bytes compressed = spends.SerializeWithBackrefs();
+    EXPECT_LT(compressed.size() * 4, spends.Serialize().size());
+    EXPECT_EQ(chia::Program::ImportFromBytes(compressed, options).Serialize(), spends.Serialize());
+
+    // A path out of the values read so far
+    EXPECT_THROW(chia::Program::ImportFromBytes(chia::utils::BytesFromHex("ff01fe0f"), options), std::runtime_error);
+}
+
+TEST(CLVM, BackrefsLargeList)
+{
+    // Every item holds the same atom, the search for it must not visit all the items written before
+    chia::ListBuilder builder;
+    for (int i = 0; i < 10000; ++i) {
+        builder.Add(chia::ToSExpPair(chia::ToSExp(i), chia::ToSExp(chia::utils::BytesFromHex("1234"))));
+    }
+    chia::Program list(builder.GetRoot());
+    chia::Bytes compressed = list.SerializeWithBackrefs();
+    EXPECT_LT(compressed.size(), list.Serialize().size());
+    chia::ImportOptions options;
+    options.allow_backrefs = true;
+    EXPECT_EQ(chia::Program::ImportFromBytes(compressed, options).Serialize(), list.Serialize());
+}
+
+TEST(CLVM, SerializedLength)
+{
+    chia::Bytes first = chia::Program(chia::Assemble("(a (q . 1) (c 0x1234 ()))")).Serialize();
+    chia::Bytes second = chia::Program(chia::ToSExp(chia::Bytes(100, 0x42))).Serialize();
+    chia::Bytes both = chia::utils::ConnectBuffers(first, second);
+    EXPECT_EQ(chia::SerializedLength(both), first.size());
+    chia::BytesView rest(both.data() + first.size(), second.size());
+    EXPECT_EQ(chia::SerializedLength(rest), second.size());
+    EXPECT_EQ(chia::SerializedLength(chia::utils::BytesFromHex("80")), 1);
+
+    chia::ImportOptions options;
+    options.max_depth = 2;
+    EXPECT_THROW(chia::SerializedLength(first, options), std::runtime_error);
+    options = chia::ImportOptions();
+    options.max_size = first.size() - 1;
+    EXPECT_THROW(chia::SerializedLength(first, options), std::runtime_error);
+    EXPECT_THROW(chia::SerializedLength(chia::BytesView(first.data(), first.size() - 1)), std::runtime_error);
+
+    options = chia::ImportOptions();
+    options.allow_backrefs = true;
+    EXPECT_EQ(chia::SerializedLength(chia::utils::BytesFromHex("ffff0102fe0280"), options), 6);
+}
+
+TEST(CLVM, TreeHashFromSerialized)
+{
+    chia::Program prog
+        = chia::Program::ImportFromAssemble("(a (q 2 0x7f 0x80 0xff (c 2 5)) (c () (q . 0x1234567890)))");
+    chia::Bytes bytes = prog.Serialize();
+    EXPECT_EQ(chia::TreeHashFromSerialized(bytes), prog.GetTreeHash());
+    EXPECT_EQ(
+        chia::TreeHashFromSerialized(chia::utils::BytesFromHex("80")), chia::Program(chia::MakeNull()).GetTreeHash());
+    EXPECT_THROW(chia::TreeHashFromSerialized(chia::BytesView(bytes.data(), bytes.size() - 1)), std::runtime_error);
+}
+
+TEST(CLVM, TreeHashDeepTree)
+{
+    chia::CLVMObjectPtr sexp = chia::MakeNull();
+    for (int i = 0; i < 100000; ++i) {
+        sexp = chia::ToSExpPair(chia::ToSExpPair(chia::ToSExp(i), chia::MakeNull()), sexp);
+    }
+    chia::Program prog(sexp);
+    EXPECT_EQ(prog.GetTreeHash(), chia::TreeHashFromSerialized(prog.Serialize()));
+}
+
+TEST(CLVM, TreeHashCached)
+{
+    chia::Program prog = chia::Program::ImportFromAssemble("((1 . 2) 3 4)");
+    auto pair = std::static_pointer_cast<chia::CLVMObject_Pair>(prog.GetSExp());
+    chia::Bytes32 hash;
+    EXPECT_FALSE(pair->GetCachedTreeHash(hash));
+    chia::Bytes32 tree_hash = prog.GetTreeHash();
+    EXPECT_TRUE(pair->GetCachedTreeHash(hash));
+    EXPECT_EQ(hash, tree_hash);
+    EXPECT_EQ(prog.GetTreeHash(), tree_hash);
+
+    // A cached subtree gives the same hash in a new tree
+    chia::Program outer(chia::ToSExpPair(prog.GetSExp(), prog.GetSExp()));
+    chia::Program copy = chia::Program::ImportFromBytes(outer.Serialize());
+    EXPECT_EQ(outer.GetTreeHash(), copy.GetTreeHash());
+
+    // A list taken from the builder is not changed by the items added after it
+    chia::ListBuilder builder;
+    builder.Add(chia::ToSExp(1));
+    builder.Add(chia::ToSExp(2));
+    chia::Program short_list(builder.GetRoot());
+    chia::Bytes32 short_hash = short_list.GetTreeHash();
+    builder.Add(chia::ToSExp(3));
+    EXPECT_EQ(short_list.GetTreeHash(), short_hash);
+    EXPECT_EQ(short_list.GetTreeHash(), chia::Program::ImportFromAssemble("(1 2)").GetTreeHash());
+    EXPECT_EQ(chia::Program(builder.GetRoot()).GetTreeHash(), chia::Program::ImportFromAssemble("(1 2 3)").GetTreeHash());
+}
+
+TEST(CLVM, Curry)
+{
+    // The curry program of clvm, the native one must give the same result
+    chia::Program curry_program = chia::Program::ImportFromAssemble(
+        "(a (q #a 4 (c 2 (c 5 (c 7 0)))) (c (q (c (q . 2) (c (c (q . 1) 5) (c (a 6 (c 2 (c 11 (q 1)))) 0))) #a (i 5 "
+        "(q 4 (q . 4) (c (c (q . 1) 9) (c (a 6 (c 2 (c 13 (c 11 0)))) 0))) (q . 11)) 1) 1))");
+    chia::Program mod = chia::Program::ImportFromAssemble("(+ 2 5 (q . 0x1234))");
+    std::vector<chia::CLVMObjectPtr> args { chia::ToSExp(7), chia::Assemble("(1 2 . 3)"), chia::MakeNull() };
+    for (std::size_t n = 0; n <= args.size(); ++n) {
+        std::vector<chia::CLVMObjectPtr> curry_args(args.begin(), args.begin() + n);
+        chia::CLVMObjectPtr arg_list = chia::MakeNull();
+        for (auto i = curry_args.rbegin(); i != curry_args.rend(); ++i) {
+            arg_list = chia::ToSExpPair(*i, arg_list);
+        }
+        auto [cost, expected] = curry_program.Run(chia::ToSExpPair(mod.GetSExp(), arg_list));
+        EXPECT_EQ(mod.Curry(curry_args).Serialize(), chia::Program(expected).Serialize());
+    }
+    EXPECT_EQ(mod.Curry(chia::ToSExp(7)).Serialize(),
+        mod.Curry(std::vector<chia::CLVMObjectPtr> { chia::ToSExp(7) }).Serialize());
+}
+
+TEST(CLVM, Uncurry)
+{
+    chia::Program mod = chia::Program::ImportFromAssemble("(+ 2 5 (q . 0x1234))");
+    std::vector<chia::CLVMObjectPtr> args { chia::ToSExp(7), chia::Assemble("(1 2 . 3)"), chia::MakeNull() };
+    auto uncurried = mod.Curry(args).Uncurry();
+    ASSERT_TRUE(uncurried.has_value());
+    auto const& [uncurried_mod, uncurried_args] = *uncurried;
+    EXPECT_EQ(uncurried_mod.GetTreeHash(), mod.GetTreeHash());
+    ASSERT_EQ(uncurried_args.size(), args.size());
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        EXPECT_EQ(chia::Program(uncurried_args[i]).GetTreeHash(), chia::Program(args[i]).GetTreeHash());
+    }
+    EXPECT_TRUE(std::get<1>(*mod.Curry(std::vector<chia::CLVMObjectPtr>()).Uncurry()).empty());
+
+    EXPECT_FALSE(mod.Uncurry().has_value());
+    EXPECT_FALSE(chia::Program::ImportFromAssemble("(a (q . 1) (c (q . 2) 2))").Uncurry().has_value());
+    EXPECT_FALSE(chia::Program::ImportFromAssemble("(a (q . 1) 1 2)").Uncurry().has_value());
+    EXPECT_FALSE(chia::Program(chia::ToSExp(2)).Uncurry().has_value());
+}
+
+TEST(CLVM, CurryTreeHash)
+{
+    chia::Program mod = chia::Program::ImportFromAssemble("(+ 2 5 (q . 0x1234))");
+    std::vector<chia::CLVMObjectPtr> args { chia::ToSExp(7), chia::Assemble("(1 2 . 3)"), chia::MakeNull() };
+    std::vector<chia::Bytes32> arg_hashes;
+    for (auto const& arg : args) {
+        arg_hashes.push_back(chia::Program(arg).GetTreeHash());
+    }
+    EXPECT_EQ(chia::CurryTreeHash(mod.GetTreeHash(), arg_hashes), mod.Curry(args).GetTreeHash());
+    EXPECT_EQ(chia::CurryTreeHash(mod.GetTreeHash(), {}), mod.Curry(std::vector<chia::CLVMObjectPtr>()).GetTreeHash());
+}
+
+TEST(CLVM_Allocator, NodesFromArena)
+{
+    chia::AllocatorPtr arena = chia::Allocator::Create();
+    chia::CLVMObjectPtr list;
+    {
+        chia::AllocatorScope scope(arena.get());
+        list = chia::ToSExpList(10, 20, 30);
+    }
+    EXPECT_EQ(chia::Allocator::GetCurrent(), nullptr);
+    EXPECT_EQ(arena->GetNumBlocks(), 1);
+    EXPECT_GT(arena->GetUsedBytes(), 0);
+    EXPECT_EQ(arena->GetReservedBytes(), chia::Allocator::MIN_BLOCK_SIZE);
+    {
+        chia::AllocatorScope scope(arena.get());
+        std::size_t used_bytes = arena->GetUsedBytes();
+        {
+            // The objects kept beyond the run are made on the heap
+            chia::AllocatorScope heap_scope(nullptr);
+            EXPECT_EQ(chia::Allocator::GetCurrent(), nullptr);
+            chia::ToSExpList(1000, 2000);
+        }
+        EXPECT_EQ(chia::Allocator::GetCurrent(), arena.get());
+        EXPECT_EQ(arena->GetUsedBytes(), used_bytes);
+    }
+    // The nodes outlive the owner of the arena
+    arena.reset();
+    EXPECT_EQ(chia::ListLen(list), 3);
+    list.reset();
+}
+
+TEST(CLVM_Allocator, ReuseNodes)
+{
+    chia::AllocatorPtr arena = chia::Allocator::Create();
+    chia::AllocatorScope scope(arena.get());
+    for (int i = 0; i < 100000; ++i) {
+        chia::ToSExpList(1000, 2000, 3000);
+    }
+    // Dropped nodes go back to the arena, it never grows beyond the first block
+    EXPECT_EQ(arena->GetNumBlocks(), 1);
+    EXPECT_GT(arena->GetUsedBytes(), chia::Allocator::MAX_BLOCK_SIZE);
+}
+
+TEST(CLVM_Allocator, LargeAllocation)
+{
+    chia::AllocatorPtr arena = chia::Allocator::Create();
+    void* p1 = arena->Allocate(8, 8);
+    void* p2 = arena->Allocate(chia::Allocator::MAX_BLOCK_SIZE * 2, 16);
+    EXPECT_NE(p1, p2);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p2) % 16, 0);
+    // Large allocations come from the heap
+    EXPECT_EQ(arena->GetNumBlocks(), 1);
+    arena->Deallocate(p2, chia::Allocator::MAX_BLOCK_SIZE * 2, 16);
+    arena->Deallocate(p1, 8, 8);
+    EXPECT_EQ(arena->Allocate(8, 8), p1);
+    arena->Deallocate(p1, 8, 8);
+}
+
 TEST(CLVM, OperatorLookup)
 {
     chia::OperatorLookup ol;
@@ -269,6 +725,106 @@ TEST(CLVM_RunProgram, FlowControl)
     EXPECT_EQ(calculate_number("(i () (q . 70) (q . 80))"), 80);
 }
 
+TEST(CLVM_RunProgram, Raise) { EXPECT_THROW(calculate_bool("(x (q . 1))"), std::runtime_error); }
+
+TEST(CLVM_RunProgram, UnknownOp)
+{
+    // Only the single byte 0x10 is `+`, a longer opcode that starts with the same byte is unknown
+    EXPECT_FALSE(calculate_bool("(0x1000 (q . 1) (q . 2))"));
+    EXPECT_THROW(calculate_bool("(0xffff01 (q . 1))"), std::runtime_error);
+}
+
+TEST(CLVM_RunProgram, SignedAtoms)
+{
+    // Integers are stored as two's complement, so they compare equal to the same bytes
+    EXPECT_TRUE(calculate_bool("(= (q . -1) (q . 0xff))"));
+    EXPECT_TRUE(calculate_bool("(= (q . 128) (q . 0x0080))"));
+    EXPECT_FALSE(calculate_bool("(= (q . 1) (q . -1))"));
+    EXPECT_FALSE(calculate_bool("(i (- (q . 2) (q . 2)) (q . 1) ())"));
+}
+
+TEST(CLVM_RunProgram, ArgSizeCost)
+{
+    // The cost of an argument is by the length of its atom, 128 takes 2 bytes and both sums take 2 bytes
+    chia::Cost short_cost, long_cost;
+    std::tie(short_cost, std::ignore) = chia::Program(chia::Assemble("(+ (q . 0x7f) (q . 1))")).Run();
+    std::tie(long_cost, std::ignore) = chia::Program(chia::Assemble("(+ (q . 0x0080) (q . 1))")).Run();
+    EXPECT_EQ(long_cost - short_cost, chia::ARITH_COST_PER_BYTE);
+}
+
+std::tuple<chia::Cost, chia::CLVMObjectPtr> op_always_42(chia::CLVMObjectPtr)
+{
+    return std::make_tuple(1, chia::ToSExp(chia::Int(42)));
+}
+
+TEST(CLVM_RunProgram, CustomOperator)
+{
+    EXPECT_EQ(&chia::OperatorLookup::GetInstance(), &chia::OperatorLookup::GetInstance());
+
+    chia::OperatorLookup lookup;
+    lookup.Assign(lookup.KeywordToAtom("+"), op_always_42);
+    chia::RunOptions options;
+    options.operator_lookup = &lookup;
+    chia::Program prog(chia::Assemble("(+ (q . 2) (q . 5))"));
+    chia::CLVMObjectPtr r;
+    std::tie(std::ignore, r) = prog.Run(chia::MakeNull(), options);
+    EXPECT_EQ(chia::ToInt(r).ToInt(), 42);
+    // The shared lookup is untouched
+    std::tie(std::ignore, r) = prog.Run();
+    EXPECT_EQ(chia::ToInt(r).ToInt(), 7);
+
+    // An operator carrying state
+    int num_calls { 0 };
+    lookup.Assign(lookup.KeywordToAtom("+"), [&num_calls](chia::CLVMObjectPtr) {
+        ++num_calls;
+        return std::make_tuple(chia::Cost(1), chia::ToSExp(chia::Int(num_calls)));
+    });
+    std::tie(std::ignore, r) = prog.Run(chia::MakeNull(), options);
+    std::tie(std::ignore, r) = prog.Run(chia::MakeNull(), options);
+    EXPECT_EQ(chia::ToInt(r).ToInt(), 2);
+    EXPECT_EQ(num_calls, 2);
+
+    lookup.Assign(lookup.KeywordToAtom("+"), nullptr);
+    std::tie(std::ignore, r) = prog.Run(chia::MakeNull(), options);
+    EXPECT_TRUE(chia::IsNull(r));
+}
+
+TEST(CLVM_RunProgram, MaxCost)
+{
+    chia::Program prog(chia::Assemble("(+ (q . 2) (q . 5))"));
+    chia::Cost cost;
+    std::tie(cost, std::ignore) = prog.Run();
+
+    chia::RunStats stats;
+    chia::RunOptions options(cost);
+    options.stats = &stats;
+    EXPECT_NO_THROW(prog.Run(chia::MakeNull(), options));
+    EXPECT_EQ(stats.cost, cost);
+    EXPECT_GT(stats.num_steps, 0);
+    EXPECT_GT(stats.num_allocated_bytes, 0);
+
+    options.max_cost = cost - 1;
+    EXPECT_THROW(prog.Run(chia::MakeNull(), options), std::runtime_error);
+    EXPECT_GT(stats.cost, cost - 1);
+
+    // The statistics are also reported when an operator raises
+    stats = {};
+    chia::Program raise(chia::Assemble("(x (q . 1))"));
+    chia::RunOptions raise_options;
+    raise_options.stats = &stats;
+    EXPECT_THROW(raise.Run(chia::MakeNull(), raise_options), std::runtime_error);
+    EXPECT_GT(stats.num_steps, 0);
+}
+
+TEST(CLVM_RunProgram, Strict)
+{
+    chia::Program prog(chia::Assemble("(0x1000 (q . 1) (q . 2))"));
+    EXPECT_NO_THROW(prog.Run());
+    chia::RunOptions options;
+    options.strict = true;
+    EXPECT_THROW(prog.Run(chia::MakeNull(), options), std::runtime_error);
+}
+
 TEST(CLVM_RunProgram, Environment)
 {
     auto f = chia::Assemble("1");
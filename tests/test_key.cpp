@@ -33,3 +33,53 @@ TEST(Key, PublicKeyToPuzzleHash)
     auto puzzle_hash_bytes = chia::utils::HashToBytes(chia::puzzle::public_key_to_puzzle_hash(public_key));
     EXPECT_EQ(puzzle_hash_bytes, PUZZLE_HASH_BYTES);
 }
+
+TEST(Key, SyntheticKeysOfShortIntegers)
+{
+    // About 1 in 256 synthetic offsets or secret exponents has a leading zero byte, which is dropped from the bytes
+    // of the integer, the synthetic keys of all those wallet keys must still match
+    using chia::puzzle::PredefinedPrograms;
+    chia::wallet::Key key(chia::utils::BytesFromHex("0102030405060708091011121314151617181920212223242526272829303132"));
+    chia::Bytes32 const& hidden_puzzle_hash
+        = PredefinedPrograms::GetInstance().GetTreeHash(PredefinedPrograms::Names::DEFAULT_HIDDEN_PUZZLE);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        chia::wallet::Key wallet_key = key.GetWalletKey(i);
+        chia::PrivateKey synthetic_secret_key
+            = chia::puzzle::calculate_synthetic_secret_key(wallet_key.GetPrivateKey(), hidden_puzzle_hash);
+        EXPECT_EQ(chia::wallet::Key(synthetic_secret_key).GetPublicKey(),
+            chia::puzzle::calculate_synthetic_public_key(wallet_key.GetPublicKey(), hidden_puzzle_hash));
+    }
+}
+
+TEST(Key, PredefinedPrograms)
+{
+    using chia::puzzle::PredefinedPrograms;
+    auto& predefined = PredefinedPrograms::GetInstance();
+    chia::Program const& mod = predefined[PredefinedPrograms::Names::MOD];
+    EXPECT_EQ(&mod, &predefined[PredefinedPrograms::Names::MOD]);
+    EXPECT_EQ(predefined.GetTreeHash(PredefinedPrograms::Names::MOD), mod.GetTreeHash());
+
+    // Registered on a registry of the test, the instance of the library is left untouched
+    PredefinedPrograms registry;
+    registry.Register("p2_conditions_copy", predefined[PredefinedPrograms::Names::P2_CONDITIONS]);
+    EXPECT_EQ(registry.GetTreeHash("p2_conditions_copy"),
+        predefined.GetTreeHash(PredefinedPrograms::Names::P2_CONDITIONS));
+    EXPECT_THROW(registry.Register("p2_conditions_copy", mod), std::runtime_error);
+    EXPECT_THROW(registry["not_registered"], std::runtime_error);
+    EXPECT_THROW(predefined["p2_conditions_copy"], std::runtime_error);
+}
+
+TEST(Key, WalletPuzzleHashes)
+{
+    // Enough keys to spread the hashing over several threads, the results must match the ones of the serial calls
+    chia::wallet::Key key(chia::utils::BytesFromHex("0102030405060708091011121314151617181920212223242526272829303132"));
+    auto puzzle_hashes = key.GetWalletPuzzleHashes(2, 2002);
+    ASSERT_EQ(puzzle_hashes.size(), 2000);
+    std::vector<chia::PublicKey> public_keys;
+    for (uint32_t i = 2; i < 2002; ++i) {
+        public_keys.push_back(key.GetWalletKey(i).GetPublicKey());
+        EXPECT_EQ(puzzle_hashes[i - 2], chia::puzzle::public_key_to_puzzle_hash(public_keys.back()));
+    }
+    EXPECT_EQ(chia::puzzle::public_keys_to_puzzle_hashes(public_keys), puzzle_hashes);
+    EXPECT_TRUE(key.GetWalletPuzzleHashes(5, 5).empty());
+}
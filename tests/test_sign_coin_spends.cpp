@@ -113,19 +113,19 @@ std::optional<chia::PrivateKey> empty_ph_to_sk(chia::Bytes32 const& puzzle_hash)
 TEST_F(SignCoinSpendsTest, TestCoinSpends)
 {
     EXPECT_THROW({
-        chia::puzzle::sign_coin_spends({spend_h}, std::bind(&SignCoinSpendsTest::pk_to_sk, this, _1), empty_ph_to_sk, additional_data, 1000000000);
+        chia::puzzle::sign_coin_spends({spend_h}, std::bind(&SignCoinSpendsTest::pk_to_sk, this, _1), empty_ph_to_sk, additional_data, chia::RunOptions(1000000000));
     }, std::runtime_error);
 
     EXPECT_THROW({
-        chia::puzzle::sign_coin_spends({spend_h}, empty_pk_to_sk, std::bind(&SignCoinSpendsTest::ph_to_sk, this, _1), additional_data, 1000000000);
+        chia::puzzle::sign_coin_spends({spend_h}, empty_pk_to_sk, std::bind(&SignCoinSpendsTest::ph_to_sk, this, _1), additional_data, chia::RunOptions(1000000000));
     }, std::runtime_error);
 
     EXPECT_THROW({
-        chia::puzzle::sign_coin_spends({spend_h}, std::bind(&SignCoinSpendsTest::pk_to_sk, this, _1), std::bind(&SignCoinSpendsTest::ph_to_sk, this, _1), additional_data, 1000000000);
+        chia::puzzle::sign_coin_spends({spend_h}, std::bind(&SignCoinSpendsTest::pk_to_sk, this, _1), std::bind(&SignCoinSpendsTest::ph_to_sk, this, _1), additional_data, chia::RunOptions(1000000000));
     }, std::runtime_error);
 
     auto spend_bundle = chia::puzzle::sign_coin_spends(
-        {spend_h}, std::bind(&SignCoinSpendsTest::pk_to_sk, this, _1), std::bind(&SignCoinSpendsTest::ph_to_sk, this, _1), additional_data, 1000000000,
+        {spend_h}, std::bind(&SignCoinSpendsTest::pk_to_sk, this, _1), std::bind(&SignCoinSpendsTest::ph_to_sk, this, _1), additional_data, chia::RunOptions(1000000000),
         {
             [this](chia::PublicKey const& public_key) { return GenerateHash(1); },
             std::bind(&SignCoinSpendsTest::derive_ph, this, _1),